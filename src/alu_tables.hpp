@@ -0,0 +1,139 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ALU_TABLES_HPP
+#define ALU_TABLES_HPP
+
+// Lookup tables for the 8-bit ALU ops that only have a few inputs. Each entry
+// holds the result in the low byte and the new flags in the high byte. The
+// tables are filled in by the compiler from the constexpr functions below,
+// which are written C++11 style (a single return each) so older compilers can
+// still evaluate them. cpu.cpp checks them against the step by step versions
+// in debug builds.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "cpu.hpp"
+
+static constexpr std::uint16_t alu_entry(std::uint8_t result, std::uint8_t flags)
+{
+    return (std::uint16_t)(result | (flags << 8));
+}
+
+template<std::size_t N, typename Gen, std::size_t... I>
+static constexpr std::array<std::uint16_t, N> make_alu_table(Gen gen, std::index_sequence<I...>)
+{
+    return std::array<std::uint16_t, N>{ { gen(I)... } };
+}
+
+// DAA, indexed by (N, H, C) << 8 | A. This is exactly where those flags sit in F
+// after shifting it left by 4.
+
+static constexpr std::uint16_t daa_add(std::uint16_t temp, bool c)
+{
+    return temp + ((c || (temp & 0xFFF0) > (9 << 4)) ? (6 << 4) : 0);
+}
+
+static constexpr std::uint16_t daa_temp(std::uint8_t a, bool n, bool h, bool c)
+{
+    return n ?
+        (std::uint16_t)(a - (h ? 6 : 0) - (c ? 6 << 4 : 0)) :
+        daa_add(a + ((h || (a & 0xF) > 9) ? 6 : 0), c);
+}
+
+static constexpr std::uint16_t daa_pack(std::uint16_t temp, bool n, bool c)
+{
+    return alu_entry((std::uint8_t)temp,
+        (n ? CPU::n_mask : 0) |
+        ((c || (!n && (temp & 0x100))) ? CPU::c_mask : 0) |
+        (((std::uint8_t)temp == 0) ? CPU::z_mask : 0));
+}
+
+struct DAAGen
+{
+    constexpr std::uint16_t operator()(std::size_t i) const
+    {
+        return daa_pack(daa_temp(i & 0xFF, !!(i & 0x400), !!(i & 0x200), !!(i & 0x100)), !!(i & 0x400), !!(i & 0x100));
+    }
+};
+
+static constexpr std::array<std::uint16_t, 0x800> daa_table =
+    make_alu_table<0x800>(DAAGen(), std::make_index_sequence<0x800>());
+
+// CB rotates/shifts and swap, indexed by kind << 9 | C << 8 | val. The kinds
+// follow the CB op code order: RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL. The Z
+// flag needs to be masked off for the unprefixed rotates on A.
+
+static constexpr std::uint8_t shift_result(unsigned kind, bool c, std::uint8_t v)
+{
+    return (std::uint8_t)(
+        kind == 0 ? (v << 1) | (v >> 7) :
+        kind == 1 ? (v >> 1) | (v << 7) :
+        kind == 2 ? (v << 1) | (c ? 0x01 : 0) :
+        kind == 3 ? (v >> 1) | (c ? 0x80 : 0) :
+        kind == 4 ? (v << 1) :
+        kind == 5 ? (v >> 1) | (v & 0x80) :
+        kind == 6 ? (v >> 4) | (v << 4) :
+        (v >> 1));
+}
+
+static constexpr bool shift_carry(unsigned kind, std::uint8_t v)
+{
+    return
+        kind == 6 ? false :
+        (kind == 0 || kind == 2 || kind == 4) ? !!(v & 0x80) :
+        !!(v & 0x01);
+}
+
+static constexpr std::uint16_t shift_pack(std::uint8_t result, bool carry)
+{
+    return alu_entry(result, (result == 0 ? CPU::z_mask : 0) | (carry ? CPU::c_mask : 0));
+}
+
+struct ShiftGen
+{
+    constexpr std::uint16_t operator()(std::size_t i) const
+    {
+        return shift_pack(shift_result((unsigned)(i >> 9), !!(i & 0x100), i & 0xFF), shift_carry((unsigned)(i >> 9), i & 0xFF));
+    }
+};
+
+static const unsigned swap_kind = 6;
+
+static constexpr std::array<std::uint16_t, 0x1000> shift_table =
+    make_alu_table<0x1000>(ShiftGen(), std::make_index_sequence<0x1000>());
+
+// INC/DEC flags other than carry, indexed by dec << 8 | result.
+
+struct IncDecGen
+{
+    constexpr std::uint16_t operator()(std::size_t i) const
+    {
+        return alu_entry((std::uint8_t)i,
+            ((i & 0x100) ? CPU::n_mask : 0) |
+            ((i & 0x0F) == ((i & 0x100) ? 0x0F : 0) ? CPU::h_mask : 0) |
+            ((i & 0xFF) == 0 ? CPU::z_mask : 0));
+    }
+};
+
+static constexpr std::array<std::uint16_t, 0x200> inc_dec_table =
+    make_alu_table<0x200>(IncDecGen(), std::make_index_sequence<0x200>());
+
+#endif
@@ -0,0 +1,117 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef AOT_HPP
+#define AOT_HPP
+
+// Interface between the emulator and ahead of time recompiled plugins. The
+// plugins are C++ written by gb-recompile (see tools/recompile.cpp) and built
+// with the same compiler as the emulator. Bump AOT_VERSION whenever anything
+// here, BlockOp or the register layout changes.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "block_cache.hpp"
+#include "instructions.hpp"
+
+#define AOT_VERSION 2
+
+#ifdef _WIN32
+#define AOT_EXPORT extern "C" __declspec(dllexport)
+#else
+#define AOT_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+class CPU;
+
+// Handed to every recompiled block. The register file is indexed by REG8 and
+// REG16 the same way as in the CPU.
+struct AOTContext
+{
+    CPU *cpu;
+    std::uint8_t *r8;
+    std::uint16_t *r16;
+    std::uint32_t *cycles;
+    bool *ime;
+
+    // Lazy flag state, see CPU::alu8(), with the values flag_op takes and the
+    // H flag for AND.
+    std::uint8_t *flag_op;
+    std::uint8_t *flag_a;
+    std::uint8_t *flag_b;
+    std::uint16_t *flag_result;
+    std::uint8_t flag_add;
+    std::uint8_t flag_sub;
+    std::uint8_t flag_logic;
+    std::uint8_t h_mask;
+
+    // Same as the callbacks used by JIT code, both return true when the block
+    // has to stop.
+    bool (*interrupt_due)(CPU *cpu);
+    bool (*run_op)(CPU *cpu, const BlockOp *op);
+};
+
+// ALU ops for recompiled code, with the same results and lazy flags as
+// CPU::alu8() for everything but ADC/SBC. CP is a SUB that doesn't store.
+
+inline void aot_add(const AOTContext *ctx, std::uint8_t src, bool subtract, bool store)
+{
+    std::uint8_t a = ctx->r8[(int)REG8::A];
+    std::uint8_t b = subtract ? (std::uint8_t)~src : src;
+    std::uint16_t result = (std::uint16_t)(a + b + (subtract ? 1 : 0));
+
+    *ctx->flag_op = subtract ? ctx->flag_sub : ctx->flag_add;
+    *ctx->flag_a = a;
+    *ctx->flag_b = b;
+    *ctx->flag_result = result;
+    if (store) ctx->r8[(int)REG8::A] = (std::uint8_t)result;
+}
+
+inline void aot_logic(const AOTContext *ctx, std::uint8_t result, bool and_op)
+{
+    ctx->r8[(int)REG8::A] = result;
+    *ctx->flag_op = ctx->flag_logic;
+    *ctx->flag_b = and_op ? ctx->h_mask : 0;
+    *ctx->flag_result = result;
+}
+
+struct AOTBlock
+{
+    std::uint16_t bank;
+    std::uint16_t adr;
+    // The ops the block was decoded to. It's only used if the emulator
+    // decodes the same ones there, so a different ROM with the same checksum
+    // or code in another bank doesn't run it.
+    std::uint16_t num_ops;
+    const BlockOp *ops;
+    void (*run)(const AOTContext *ctx);
+};
+
+struct AOTPlugin
+{
+    std::uint32_t version;
+    std::uint16_t global_checksum;
+    std::size_t num_blocks;
+    const AOTBlock *blocks;
+};
+
+// Every plugin exports this under C linkage.
+typedef const AOTPlugin* (*AOTEntry)();
+#define AOT_ENTRY_NAME "gb_aot_plugin"
+
+#endif
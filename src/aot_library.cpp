@@ -0,0 +1,83 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "aot_library.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+#include "aot.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+std::string AOTLibrary::fileName(std::uint16_t global_checksum)
+{
+    std::ostringstream name;
+    name << "aot_" << std::hex << std::setfill('0') << std::setw(4) << global_checksum;
+#ifdef _WIN32
+    name << ".dll";
+#else
+    name << ".so";
+#endif
+    return name.str();
+}
+
+const AOTPlugin* AOTLibrary::load(const std::string &dir, std::uint16_t global_checksum)
+{
+    unload();
+
+    std::string path = fileName(global_checksum);
+    if (!dir.empty()) path = dir + "/" + path;
+
+#ifdef _WIN32
+    HMODULE lib = LoadLibraryA(path.c_str());
+    if (!lib) return nullptr;
+    handle = lib;
+    AOTEntry entry = reinterpret_cast<AOTEntry>(GetProcAddress(lib, AOT_ENTRY_NAME));
+#else
+    handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) return nullptr;
+    AOTEntry entry = reinterpret_cast<AOTEntry>(dlsym(handle, AOT_ENTRY_NAME));
+#endif
+
+    const AOTPlugin *found = entry ? entry() : nullptr;
+    if (!found || found->version != AOT_VERSION || found->global_checksum != global_checksum)
+    {
+        unload();
+        return nullptr;
+    }
+
+    plugin = found;
+    return plugin;
+}
+
+void AOTLibrary::unload()
+{
+    if (!handle) return;
+#ifdef _WIN32
+    FreeLibrary(static_cast<HMODULE>(handle));
+#else
+    dlclose(handle);
+#endif
+    handle = nullptr;
+    plugin = nullptr;
+}
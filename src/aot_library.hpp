@@ -0,0 +1,51 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef AOT_LIBRARY_HPP
+#define AOT_LIBRARY_HPP
+
+#include <cstdint>
+#include <string>
+
+struct AOTPlugin;
+
+// Owns a loaded AOT plugin. Plugins are looked up by the cart's global
+// checksum as aot_XXXX.dll (or .so) in a given directory.
+class AOTLibrary
+{
+public:
+    AOTLibrary() : handle(nullptr), plugin(nullptr) {}
+    ~AOTLibrary() { unload(); }
+
+    AOTLibrary(const AOTLibrary&) = delete;
+    AOTLibrary& operator=(const AOTLibrary&) = delete;
+
+    // Returns the plugin, or nullptr if there isn't one for this checksum or it
+    // was built against a different version of the emulator.
+    const AOTPlugin* load(const std::string &dir, std::uint16_t global_checksum);
+    void unload();
+
+    const AOTPlugin* get() const { return plugin; }
+
+    static std::string fileName(std::uint16_t global_checksum);
+
+private:
+    void *handle;
+    const AOTPlugin *plugin;
+};
+
+#endif
@@ -0,0 +1,64 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ATTENTION_HPP
+#define ATTENTION_HPP
+
+#include <atomic>
+#include <cstdint>
+
+// One word for everything that takes the run loops off their fast path.
+// Whatever causes a condition sets its bit, so the loops only have to test
+// the word to know nothing unusual needs handling.
+class Attention
+{
+public:
+    enum Flag : std::uint32_t
+    {
+        interrupt = 0x01,   // IE & IF is non zero.
+        halt = 0x02,        // The CPU is halted.
+        stop = 0x04,        // The CPU is in STOP mode.
+        watchpoint = 0x08,  // A watchpoint was hit.
+        host_stop = 0x10,   // The host asked for the run loop to return.
+        run_end = 0x20,     // The cycle a run loop was asked to run until was reached.
+
+        // The ones the CPU deals with itself.
+        cpu = interrupt | halt | stop,
+        // The ones that make System's run loops return. Idle time isn't
+        // skipped while any are set, so the loop can return on time.
+        run_stop = watchpoint | host_stop | run_end,
+    };
+
+    Attention() :
+        word(0)
+    {}
+
+    std::uint32_t get() const { return word.load(std::memory_order_relaxed); }
+    void set(std::uint32_t flags) { word.fetch_or(flags, std::memory_order_relaxed); }
+    void clear(std::uint32_t flags) { word.fetch_and(~flags, std::memory_order_relaxed); }
+    void assign(std::uint32_t flags, bool on)
+    {
+        if (on) set(flags);
+        else clear(flags);
+    }
+
+private:
+    // Host stop requests can come from another thread.
+    std::atomic<std::uint32_t> word;
+};
+
+#endif
@@ -0,0 +1,287 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "block_cache.hpp"
+
+#include "aot.hpp"
+#include "cart.hpp"
+#include "instructions.hpp"
+#include "mmu.hpp"
+
+static std::uint8_t op_length(std::uint8_t op_code)
+{
+    switch (op_code)
+    {
+    case 0x06: case 0x0e: case 0x16: case 0x1e: case 0x26: case 0x2e: case 0x36: case 0x3e:
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+    case 0xc6: case 0xce: case 0xd6: case 0xde: case 0xe6: case 0xee: case 0xf6: case 0xfe:
+    case 0xe0: case 0xf0: case 0xe8: case 0xf8: case 0xcb:
+        return 2;
+    case 0x01: case 0x11: case 0x21: case 0x31: case 0x08:
+    case 0xc2: case 0xc3: case 0xca: case 0xd2: case 0xda:
+    case 0xc4: case 0xcc: case 0xcd: case 0xd4: case 0xdc:
+    case 0xea: case 0xfa:
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+static const std::size_t max_block_ops = 64;
+
+bool ends_block(std::uint8_t op_code)
+{
+    switch (op_code)
+    {
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+    case 0xc2: case 0xc3: case 0xca: case 0xd2: case 0xda: case 0xe9:
+    case 0xc4: case 0xcc: case 0xcd: case 0xd4: case 0xdc:
+    case 0xc0: case 0xc8: case 0xd0: case 0xd8: case 0xc9: case 0xd9:
+    case 0xc7: case 0xcf: case 0xd7: case 0xdf: case 0xe7: case 0xef: case 0xf7: case 0xff:
+    case 0x76: case 0x10:
+        return true;
+    default:
+        return false;
+    }
+}
+
+struct IdiomShape
+{
+    Idiom idiom;
+    std::size_t size;
+    std::uint8_t ops[7];
+};
+
+static const IdiomShape idiom_shapes[] = {
+    { Idiom::copy_b, 5, { 0x2a, 0x12, 0x13, 0x05, 0x20 } },
+    { Idiom::copy_c, 5, { 0x2a, 0x12, 0x13, 0x0d, 0x20 } },
+    { Idiom::copy_bc, 7, { 0x2a, 0x12, 0x13, 0x0b, 0x78, 0xb1, 0x20 } },
+    { Idiom::fill_b, 3, { 0x22, 0x05, 0x20 } },
+    { Idiom::fill_c, 3, { 0x22, 0x0d, 0x20 } },
+};
+
+static Idiom find_idiom(const std::vector<BlockOp> &ops)
+{
+    for (const IdiomShape &shape : idiom_shapes)
+    {
+        if (ops.size() != shape.size) continue;
+
+        int length = 0;
+        bool match = true;
+        for (std::size_t i = 0; i < shape.size; ++i)
+        {
+            match = match && ops[i].op_code == shape.ops[i];
+            length += ops[i].length;
+        }
+
+        // The JR has to go back to the start of the block.
+        if (match && (std::int8_t)ops.back().imm[0] == -length) return shape.idiom;
+    }
+    return Idiom::none;
+}
+
+// Ops that can't write memory, the stack or PC.
+static bool is_poll_op(const BlockOp &op)
+{
+    std::uint8_t op_code = op.op_code;
+
+    if (op_code == 0xcb) return (op.imm[0] & 0xC0) == 0x40 || (op.imm[0] & 7) != 6;
+    if (op_code >= 0x40 && op_code < 0xc0) return (op_code & 0xF8) != 0x70;
+    if ((op_code & 0xC7) == 0xC6) return true;
+
+    switch (op_code)
+    {
+    case 0x00:
+    case 0x06: case 0x0e: case 0x16: case 0x1e: case 0x26: case 0x2e: case 0x3e:
+    case 0x04: case 0x0c: case 0x14: case 0x1c: case 0x24: case 0x2c: case 0x3c:
+    case 0x05: case 0x0d: case 0x15: case 0x1d: case 0x25: case 0x2d: case 0x3d:
+    case 0x03: case 0x13: case 0x23: case 0x0b: case 0x1b: case 0x2b:
+    case 0x0a: case 0x1a: case 0x2a: case 0x3a: case 0xf0: case 0xf2: case 0xfa:
+    case 0x07: case 0x0f: case 0x17: case 0x1f: case 0x27: case 0x2f: case 0x37: case 0x3f:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool find_poll(std::uint16_t adr, const std::vector<BlockOp> &ops)
+{
+    int length = 0;
+    for (std::size_t i = 0; i + 1 < ops.size(); ++i)
+    {
+        if (!is_poll_op(ops[i])) return false;
+        length += ops[i].length;
+    }
+
+    const BlockOp &jump = ops.back();
+    std::uint16_t imm16 = (std::uint16_t)(jump.imm[0] | jump.imm[1] << 8);
+    switch (jump.op_code)
+    {
+    case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:
+        return (std::int8_t)jump.imm[0] == -(length + 2);
+    case 0xc3: case 0xc2: case 0xca: case 0xd2: case 0xda:
+        return imm16 == adr;
+    default:
+        return false;
+    }
+}
+
+static bool same_ops(const AOTBlock &aot, const std::vector<BlockOp> &ops)
+{
+    if (aot.num_ops != ops.size()) return false;
+    for (std::size_t i = 0; i < ops.size(); ++i)
+    {
+        const BlockOp &a = aot.ops[i];
+        const BlockOp &b = ops[i];
+        if (a.op_code != b.op_code || a.length != b.length) return false;
+        for (int imm = 0; imm < b.length - 1; ++imm)
+        {
+            if (a.imm[imm] != b.imm[imm]) return false;
+        }
+    }
+    return true;
+}
+
+void BlockCache::reset()
+{
+    rom_blocks.clear();
+    ram_blocks.clear();
+    ram_blocks.resize(0x4000);
+    ram_code.reset();
+    ram_stale = false;
+    dirty = false;
+}
+
+Block* BlockCache::lookup(std::uint16_t adr)
+{
+    if (adr < 0x8000)
+    {
+        std::size_t bank = adr < 0x4000 ? 0 : cart->getROMBank();
+        if (bank >= rom_blocks.size()) rom_blocks.resize(bank + 1);
+        std::vector<std::unique_ptr<Block>> &blocks = rom_blocks[bank];
+        if (blocks.empty()) blocks.resize(0x4000);
+
+        std::unique_ptr<Block> &block = blocks[adr & 0x3fff];
+        if (!block)
+        {
+            block = decode(adr, adr < 0x4000 ? 0x4000 : 0x8000);
+            if (block) block->idiom = find_idiom(block->ops);
+            auto aot = aot_blocks.find((std::uint32_t)bank << 16 | adr);
+            if (block && aot != aot_blocks.end() && same_ops(*aot->second, block->ops))
+            {
+                block->aot = aot->second->run;
+            }
+        }
+        return block.get();
+    }
+
+    std::uint32_t end;
+    if (adr >= 0xc000 && adr < 0xe000) end = 0xe000;
+    else if (adr >= 0xff80 && adr < 0xffff) end = 0xffff;
+    else return nullptr;
+
+    if (ram_stale)
+    {
+        for (std::unique_ptr<Block> &block : ram_blocks) block.reset();
+        ram_code.reset();
+        ram_stale = false;
+        mmu->unprotect_code();
+    }
+
+    std::unique_ptr<Block> &block = ram_blocks[adr - 0xc000];
+    if (!block)
+    {
+        block = decode(adr, end);
+        if (block)
+        {
+            std::uint16_t first = adr;
+            for (const BlockOp &op : block->ops)
+            {
+                for (int i = 0; i < op.length; ++i) ram_code[adr++] = true;
+            }
+            mmu->protect_code(first, (std::uint16_t)(adr - 1));
+        }
+    }
+    return block.get();
+}
+
+void BlockCache::drop_native()
+{
+    auto drop = [](std::unique_ptr<Block> &block)
+    {
+        if (!block) return;
+        block->runs = 0;
+        block->native = nullptr;
+    };
+
+    for (std::vector<std::unique_ptr<Block>> &bank : rom_blocks)
+    {
+        for (std::unique_ptr<Block> &block : bank) drop(block);
+    }
+    for (std::unique_ptr<Block> &block : ram_blocks) drop(block);
+}
+
+void BlockCache::set_aot(const AOTPlugin *plugin)
+{
+    aot_blocks.clear();
+    if (plugin)
+    {
+        for (std::size_t i = 0; i < plugin->num_blocks; ++i)
+        {
+            const AOTBlock &block = plugin->blocks[i];
+            aot_blocks[(std::uint32_t)block.bank << 16 | block.adr] = &block;
+        }
+    }
+
+    // Blocks already decoded would miss out.
+    reset();
+}
+
+std::unique_ptr<Block> BlockCache::decode(std::uint16_t adr, std::uint32_t end)
+{
+    std::unique_ptr<Block> block(new Block);
+    block->ops = decode_block([this](std::uint16_t a) { return mmu->peek_mem(a); }, adr, end);
+
+    if (block->ops.empty()) return nullptr;
+    block->poll = find_poll(adr, block->ops);
+    return block;
+}
+
+std::vector<BlockOp> decode_block(const std::function<std::uint8_t(std::uint16_t)> &read,
+    std::uint16_t adr, std::uint32_t end)
+{
+    const Instructions &instr = Instructions::get();
+    std::vector<BlockOp> ops;
+
+    while (ops.size() < max_block_ops && adr < end)
+    {
+        BlockOp op = {};
+        op.op_code = read(adr);
+        op.length = op_length(op.op_code);
+
+        // Unimplemented op codes are left for the interpreter to report.
+        if (!instr.ops[op.op_code] || adr + op.length > end) break;
+
+        for (int i = 1; i < op.length; ++i) op.imm[i - 1] = read(adr + i);
+        ops.push_back(op);
+        adr += op.length;
+
+        if (ends_block(op.op_code)) break;
+    }
+
+    return ops;
+}
@@ -0,0 +1,143 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BLOCK_CACHE_HPP
+#define BLOCK_CACHE_HPP
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class Cart;
+class CPU;
+class MMU;
+struct AOTBlock;
+struct AOTContext;
+struct AOTPlugin;
+
+// An instruction with its immediate bytes already fetched.
+struct BlockOp
+{
+    std::uint8_t op_code;
+    std::uint8_t imm[2];
+    std::uint8_t length;
+};
+
+// Copy and fill loops CPU::run_idiom() knows how to run in bulk, named after
+// the register they count down in.
+enum class Idiom : std::uint8_t
+{
+    none,
+    copy_b,     // LD A,(HL+) ; LD (DE),A ; INC DE ; DEC B ; JR NZ
+    copy_c,     // LD A,(HL+) ; LD (DE),A ; INC DE ; DEC C ; JR NZ
+    copy_bc,    // LD A,(HL+) ; LD (DE),A ; INC DE ; DEC BC ; LD A,B ; OR C ; JR NZ
+    fill_b,     // LD (HL+),A ; DEC B ; JR NZ
+    fill_c,     // LD (HL+),A ; DEC C ; JR NZ
+};
+
+// A run of instructions up to and including the first jump, call, return or
+// halt.
+struct Block
+{
+    std::vector<BlockOp> ops;
+
+    // Used by the JIT, see CPU::run_jit().
+    std::uint32_t runs = 0;
+    void (*native)(CPU *cpu) = nullptr;
+
+    // Recompiled code from an AOT plugin, if it has this block.
+    void (*aot)(const AOTContext *ctx) = nullptr;
+
+    // Set when the whole block is a loop back to its start matching one of the
+    // idioms. Only looked for in ROM, where the loop can't overwrite itself.
+    Idiom idiom = Idiom::none;
+
+    // Set when the whole block is a loop back to its start that only reads
+    // memory, which makes it a possible busy wait. See CPU::run_poll().
+    bool poll = false;
+};
+
+// Decodes the block at adr, reading bytes with read and never reading from end
+// onwards. Stops short of op codes the CPU doesn't implement, so the result
+// can be empty.
+std::vector<BlockOp> decode_block(const std::function<std::uint8_t(std::uint16_t)> &read,
+    std::uint16_t adr, std::uint32_t end);
+bool ends_block(std::uint8_t op_code);
+
+// Decoded blocks, keyed by ROM bank and address. Code in WRAM and HRAM is
+// cached too, and is thrown away as soon as something writes over it.
+class BlockCache
+{
+public:
+    BlockCache(MMU *mmu, Cart *cart) :
+        mmu(mmu), cart(cart)
+    {
+        reset();
+    }
+
+    void reset();
+
+    // Block starting at adr, decoded on first use. Returns nullptr if the code
+    // there can't be cached.
+    Block* lookup(std::uint16_t adr);
+
+    // Forget the native code of every block.
+    void drop_native();
+
+    // Attach the recompiled blocks of a plugin, or detach with nullptr.
+    void set_aot(const AOTPlugin *plugin);
+
+    // A ROM write may switch banks under the running block.
+    void notify_rom_write() { dirty = true; }
+    // Takes the WRAM address, not the echo.
+    void notify_ram_write(std::uint16_t adr)
+    {
+        if (ram_code[adr])
+        {
+            ram_stale = true;
+            dirty = true;
+        }
+    }
+
+    // Set when a write may have changed the code of the running block. The CPU
+    // clears it before each block.
+    bool dirty;
+
+private:
+    MMU *mmu;
+    Cart *cart;
+
+    std::vector<std::vector<std::unique_ptr<Block>>> rom_blocks;
+    // Indexed from 0xc000.
+    std::vector<std::unique_ptr<Block>> ram_blocks;
+    // Bytes of RAM that cached blocks were decoded from.
+    std::bitset<0x10000> ram_code;
+    // RAM blocks can't be freed while one might be running, so a write only
+    // marks them and the next lookup drops them.
+    bool ram_stale;
+
+    // Recompiled code, keyed by bank << 16 | adr.
+    std::unordered_map<std::uint32_t, const AOTBlock*> aot_blocks;
+
+    std::unique_ptr<Block> decode(std::uint16_t adr, std::uint32_t end);
+};
+
+#endif
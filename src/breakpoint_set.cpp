@@ -0,0 +1,61 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "breakpoint_set.hpp"
+
+void BreakpointSet::add(std::uint16_t adr, const Condition &cond)
+{
+    if (cond.empty()) conditions.erase(adr);
+    else conditions[adr] = cond;
+
+    if (bits.test(adr)) return;
+    bits.set(adr);
+    ++count;
+}
+
+void BreakpointSet::remove(std::uint16_t adr)
+{
+    if (!bits.test(adr)) return;
+    bits.reset(adr);
+    --count;
+    conditions.erase(adr);
+}
+
+void BreakpointSet::clear()
+{
+    bits.reset();
+    count = 0;
+    conditions.clear();
+}
+
+const Condition& BreakpointSet::getCondition(std::uint16_t adr) const
+{
+    static const Condition always;
+    auto it = conditions.find(adr);
+    return it == conditions.end() ? always : it->second;
+}
+
+std::vector<std::uint16_t> BreakpointSet::list() const
+{
+    std::vector<std::uint16_t> adrs;
+    adrs.reserve(count);
+    for (std::uint32_t adr = 0; adrs.size() < count; ++adr)
+    {
+        if (bits.test(adr)) adrs.push_back((std::uint16_t)adr);
+    }
+    return adrs;
+}
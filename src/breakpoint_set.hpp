@@ -0,0 +1,58 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BREAKPOINT_SET_HPP
+#define BREAKPOINT_SET_HPP
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "condition.hpp"
+
+// Any number of addresses, with a bit for each so checking one is a single
+// lookup. The count is kept so an empty set can be skipped altogether.
+// Conditions are kept apart, as only the few addresses that are hit need them.
+class BreakpointSet
+{
+public:
+    BreakpointSet() :
+        count(0)
+    {}
+
+    // Replaces the condition if adr is already in the set.
+    void add(std::uint16_t adr, const Condition &cond = Condition());
+    void remove(std::uint16_t adr);
+    void clear();
+
+    bool contains(std::uint16_t adr) const { return bits.test(adr); }
+    // Empty, so always true, for unconditional breakpoints.
+    const Condition& getCondition(std::uint16_t adr) const;
+    bool empty() const { return count == 0; }
+    std::size_t size() const { return count; }
+    // In increasing address order.
+    std::vector<std::uint16_t> list() const;
+
+private:
+    std::bitset<0x10000> bits;
+    std::size_t count;
+    std::map<std::uint16_t, Condition> conditions;
+};
+
+#endif
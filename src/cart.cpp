@@ -15,15 +15,20 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <istream>
+#include <stdexcept>
 
 #include "cart.hpp"
 
 #include "config.hpp"
+#include "scheduler.hpp"
 
 static const std::size_t rom_min_size = 32 * 1024;
+// Machine cycles in a second of MBC3's clock.
+static const std::uint64_t rtc_second = 1 << 20;
 
 static const std::array<std::uint8_t, 48> logo_data = {
     0xce, 0xed, 0x66, 0x66, 0xcc, 0x0d, 0x00, 0x0b, 0x03, 0x73, 0x00, 0x83, 0x00, 0x0c, 0x00, 0x0d,
@@ -45,12 +50,58 @@ CartHeader::CartHeader() :
     checksum(0),
     global_checksum(0),
     checksum_passed(false),
+    global_checksum_passed(false),
     logo_check_passed(false)
 {
     memset(&cart_type, 0, sizeof(cart_type));
 }
 
+Cart::Cart(const Scheduler *scheduler) :
+    rom(rom_min_size, 0xff), scheduler(scheduler)
+{
+    bind_mapper();
+    reset();
+}
+
+Cart::Cart(const Cart &other) :
+    scheduler(other.scheduler)
+{
+    *this = other;
+}
+
+Cart& Cart::operator=(const Cart &other)
+{
+    header = other.header;
+    rom = other.rom;
+    ram = other.ram;
+    ctrl_regs = other.ctrl_regs;
+    rom_bank_high = other.rom_bank_high;
+    rtc_regs = other.rtc_regs;
+    rtc_latched = other.rtc_latched;
+    rtc_select = other.rtc_select;
+    rtc_synced = other.rtc_synced;
+    rom_bank_base = other.rom_bank_base;
+    ram_bank_base = other.ram_bank_base;
+    ram_enabled = other.ram_enabled;
+    write_control = other.write_control;
+    read_ram = other.read_ram;
+    write_ram = other.write_ram;
+    ram_direct = other.ram_direct;
+    map_banks();
+    return *this;
+}
+
 void Cart::loadCart(std::istream &cartFile)
+{
+    // Loaded on the side, so a cart that can't be used leaves this one be.
+    Cart loaded(scheduler);
+    loaded.read_cart(cartFile);
+    loaded.bind_mapper();
+    *this = loaded;
+    reset();
+}
+
+void Cart::read_cart(std::istream &cartFile)
 {
     header = CartHeader();
 
@@ -91,7 +142,7 @@ void Cart::loadCart(std::istream &cartFile)
         // FALL-THROUGH
     case 0x08:
         header.cart_type.ram = true;
-        // FALL_THROUGH
+        // FALL-THROUGH
     case 0x00:
         header.cart_type.controller = CartController::ROM;
         break;
@@ -104,7 +155,7 @@ void Cart::loadCart(std::istream &cartFile)
     case 0x01:
         header.cart_type.controller = CartController::MBC1;
         break;
-    case 0x04:
+    case 0x06:
         header.cart_type.battery = true;
         header.cart_type.ram = true;
         // FALL-THROUGH
@@ -265,85 +316,267 @@ void Cart::loadCart(std::istream &cartFile)
 
 void Cart::reset()
 {
-    rom_bank_base = 0x4000;
-    ram_mode = RamMode::OFF;
+    ctrl_regs.fill(0);
+    rom_bank_high = 0;
+    rtc_regs.fill(0);
+    rtc_latched.fill(0);
+    rtc_select = 0;
+    rtc_synced = scheduler ? scheduler->now() : 0;
+    rom_bank_base = rom_offset(1);
     ram_bank_base = 0;
+    ram_enabled = false;
+    map_banks();
+}
 
-    ctrl_regs.fill(0);
+const std::uint8_t* Cart::mapROM(std::uint16_t adr, std::size_t len)
+{
+    if ((adr & 0x3fff) + len > 0x4000) return nullptr;
+    if (adr < 0x4000) return rom.data() + adr;
+    return rom_bank + (adr - 0x4000);
 }
 
-std::uint8_t Cart::readROM(std::uint16_t adr)
+std::uint8_t* Cart::mapRAM(std::uint16_t adr, std::size_t len)
 {
-    if (adr < 0x4000) return rom.at(adr);
-    return rom.at(rom_bank_base + adr - 0x4000);
+    if (!ram_bank || !ram_direct || adr + len > ram_window) return nullptr;
+    return ram_bank + adr;
 }
 
-void Cart::writeROM(std::uint16_t adr, std::uint8_t val)
+void Cart::map_banks()
 {
-    ctrl_regs.at(adr >> 13) = val;
+    rom_bank = rom.data() + rom_bank_base;
+    ram_bank = (ram_enabled && !rtc_select && !ram.empty()) ? ram.data() + ram_bank_base : nullptr;
+    ram_window = std::min<std::size_t>(ram.size(), 0x2000);
+}
 
-    switch (header.cart_type.controller)
+std::size_t Cart::rom_offset(std::size_t bank) const
+{
+    // Sizes are all powers of two.
+    return (bank & (rom.size() / 0x4000 - 1)) * 0x4000;
+}
+
+std::size_t Cart::ram_offset(std::size_t bank) const
+{
+    if (ram.size() <= 0x2000) return 0;
+    return (bank & (ram.size() / 0x2000 - 1)) * 0x2000;
+}
+
+void Cart::sync_rtc()
+{
+    if (!scheduler) return;
+
+    std::uint64_t now = scheduler->now();
+    // The halt bit stops the clock, and what was left of the second with it.
+    if (rtc_regs[4] & 0x40)
     {
-    case CartController::MBC1:
-        {
-            rom_bank_base = ctrl_regs[1];
-            if (rom_bank_base == 0) rom_bank_base = 1;
-            ram_bank_base = 0;
-
-            if (ctrl_regs[3] & 0x01)
-            {
-                ram_bank_base = ctrl_regs[2] & 0x03;
-            }
-            else
-            {
-                rom_bank_base += (ctrl_regs[2] & 0x03) << 8;
-            }
-
-            rom_bank_base *= 0x4000;
-            ram_bank_base *= 0x2000;
-        }
-    case CartController::ROM:
-        ram_mode = ((ctrl_regs[0] & 0x0f) == 0x0a) ? RamMode::ON : RamMode::OFF;
-        break;
-    default:
-        assert(false);
+        rtc_synced = now;
+        return;
+    }
+
+    std::uint64_t seconds = (now - rtc_synced) / rtc_second;
+    rtc_synced += seconds * rtc_second;
+    for (; seconds; --seconds) tick_rtc();
+}
+
+void Cart::tick_rtc()
+{
+    // Values written out of range count up to the top of their bits and
+    // wrap to 0 without carrying.
+    if (rtc_regs[0] != 59)
+    {
+        rtc_regs[0] = (std::uint8_t)((rtc_regs[0] + 1) & 0x3f);
+        return;
     }
+    rtc_regs[0] = 0;
+    if (rtc_regs[1] != 59)
+    {
+        rtc_regs[1] = (std::uint8_t)((rtc_regs[1] + 1) & 0x3f);
+        return;
+    }
+    rtc_regs[1] = 0;
+    if (rtc_regs[2] != 23)
+    {
+        rtc_regs[2] = (std::uint8_t)((rtc_regs[2] + 1) & 0x1f);
+        return;
+    }
+    rtc_regs[2] = 0;
+
+    // 9 bits of days, the top one in DH bit 0. Overflowing sets the carry
+    // in bit 7, which stays until it's written.
+    if (++rtc_regs[3] != 0) return;
+    if (rtc_regs[4] & 0x01) rtc_regs[4] = (std::uint8_t)((rtc_regs[4] & 0xfe) | 0x80);
+    else rtc_regs[4] |= 0x01;
+}
+
+template<>
+void Cart::write_control_regs<CartController::ROM>(std::uint16_t adr, std::uint8_t val)
+{
+    ctrl_regs[adr >> 13] = val;
+    ram_enabled = (ctrl_regs[0] & 0x0f) == 0x0a;
+    map_banks();
 }
 
-std::uint8_t Cart::readRAM(std::uint16_t adr)
+template<>
+void Cart::write_control_regs<CartController::MBC1>(std::uint16_t adr, std::uint8_t val)
 {
-    if (ram.empty()) return 0xff;
+    ctrl_regs[adr >> 13] = val;
+
+    // The 5 bit bank register can't select bank 0. The 2 bit one goes on
+    // top of it, and also selects the RAM bank in mode 1.
+    std::size_t bank = ctrl_regs[1] & 0x1f;
+    if (bank == 0) bank = 1;
+    std::size_t high = ctrl_regs[2] & 0x03;
 
-    switch (ram_mode)
+    rom_bank_base = rom_offset(high << 5 | bank);
+    ram_bank_base = (ctrl_regs[3] & 0x01) ? ram_offset(high) : 0;
+
+    ram_enabled = (ctrl_regs[0] & 0x0f) == 0x0a;
+    map_banks();
+}
+
+template<>
+void Cart::write_control_regs<CartController::MBC2>(std::uint16_t adr, std::uint8_t val)
+{
+    // Only the lower half is decoded, bit 8 of the address picks between
+    // the RAM enable and the 4 bit bank register.
+    if (adr >= 0x4000) return;
+
+    if (adr & 0x100)
+    {
+        std::size_t bank = val & 0x0f;
+        if (bank == 0) bank = 1;
+        rom_bank_base = rom_offset(bank);
+    }
+    else
+    {
+        ram_enabled = (val & 0x0f) == 0x0a;
+    }
+    map_banks();
+}
+
+template<>
+void Cart::write_control_regs<CartController::MBC3>(std::uint16_t adr, std::uint8_t val)
+{
+    std::uint8_t old = ctrl_regs[adr >> 13];
+    ctrl_regs[adr >> 13] = val;
+
+    switch (adr >> 13)
     {
-    case Cart::RamMode::OFF:
-        return 0xff;
-    case Cart::RamMode::HALF:
-        return 0xf0 | ram.at(ram_bank_base + adr);
-    case Cart::RamMode::ON:
-        return ram.at(ram_bank_base + adr);
+    case 0:
+        ram_enabled = (val & 0x0f) == 0x0a;
+        break;
+    case 1:
+        {
+            std::size_t bank = val & 0x7f;
+            if (bank == 0) bank = 1;
+            rom_bank_base = rom_offset(bank);
+        }
+        break;
+    case 2:
+        rtc_select = (val >= 0x08 && val <= 0x0c) ? val : 0;
+        if (!rtc_select) ram_bank_base = ram_offset(val & 0x07);
+        break;
+    case 3:
+        // Writing 0 then 1 latches the clock.
+        if (old == 0x00 && val == 0x01)
+        {
+            sync_rtc();
+            rtc_latched = rtc_regs;
+        }
+        break;
     }
+    map_banks();
+}
 
-    assert(false);
-    return 0xff;
+template<>
+void Cart::write_control_regs<CartController::MBC5>(std::uint16_t adr, std::uint8_t val)
+{
+    if ((adr & 0xf000) == 0x3000) rom_bank_high = val & 0x01;
+    else ctrl_regs[adr >> 13] = val;
+
+    // Bank 0 can be mapped at 0x4000. The RAM bank register's bit 3 drives
+    // the motor in rumble carts.
+    rom_bank_base = rom_offset((std::size_t)rom_bank_high << 8 | ctrl_regs[1]);
+    ram_bank_base = ram_offset(ctrl_regs[2] & (header.cart_type.rumble ? 0x07 : 0x0f));
+    ram_enabled = (ctrl_regs[0] & 0x0f) == 0x0a;
+    map_banks();
 }
 
-void Cart::writeRAM(std::uint16_t adr, std::uint8_t val)
+void Cart::bind_mapper()
 {
-    if (ram.empty()) return;
+    read_ram = &Cart::read_ram_plain;
+    write_ram = &Cart::write_ram_plain;
+    ram_direct = true;
 
-    switch (ram_mode)
+    switch (header.cart_type.controller)
     {
-    case Cart::RamMode::OFF:
-        return;
+    case CartController::ROM:
+        write_control = &Cart::write_control_regs<CartController::ROM>;
+        break;
+    case CartController::MBC1:
+        write_control = &Cart::write_control_regs<CartController::MBC1>;
+        break;
+    case CartController::MBC2:
+        write_control = &Cart::write_control_regs<CartController::MBC2>;
+        read_ram = &Cart::read_ram_mbc2;
+        write_ram = &Cart::write_ram_mbc2;
+        ram_direct = false;
         break;
-    case Cart::RamMode::HALF:
-        ram.at(ram_bank_base + adr) = val & 0x0f;
+    case CartController::MBC3:
+        write_control = &Cart::write_control_regs<CartController::MBC3>;
+        read_ram = &Cart::read_ram_mbc3;
+        write_ram = &Cart::write_ram_mbc3;
         break;
-    case Cart::RamMode::ON:
-        ram.at(ram_bank_base + adr) = val & 0xf0;
+    case CartController::MBC5:
+        write_control = &Cart::write_control_regs<CartController::MBC5>;
         break;
+    default:
+        throw std::runtime_error("Unsupported cartridge type");
     }
+}
+
+std::uint8_t Cart::read_ram_plain(std::uint16_t adr)
+{
+    if (!ram_bank || adr >= ram_window) return 0xff;
+    return ram_bank[adr];
+}
+
+void Cart::write_ram_plain(std::uint16_t adr, std::uint8_t val)
+{
+    if (!ram_bank || adr >= ram_window) return;
+    ram_bank[adr] = val;
+}
+
+std::uint8_t Cart::read_ram_mbc2(std::uint16_t adr)
+{
+    if (!ram_bank) return 0xff;
+    return 0xf0 | ram_bank[adr & 0x1ff];
+}
 
-    assert(false);
+void Cart::write_ram_mbc2(std::uint16_t adr, std::uint8_t val)
+{
+    if (!ram_bank) return;
+    ram_bank[adr & 0x1ff] = val & 0x0f;
+}
+
+std::uint8_t Cart::read_ram_mbc3(std::uint16_t adr)
+{
+    if (!rtc_select) return read_ram_plain(adr);
+    if (!ram_enabled) return 0xff;
+    return rtc_latched[rtc_select - 0x08];
+}
+
+void Cart::write_ram_mbc3(std::uint16_t adr, std::uint8_t val)
+{
+    static const std::array<std::uint8_t, 5> rtc_masks = { { 0x3f, 0x3f, 0x1f, 0xff, 0xc1 } };
+
+    if (!rtc_select)
+    {
+        write_ram_plain(adr, val);
+        return;
+    }
+    if (!ram_enabled) return;
+    sync_rtc();
+    rtc_regs[rtc_select - 0x08] = val & rtc_masks[rtc_select - 0x08];
+    // Writing the seconds starts a new second.
+    if (rtc_select == 0x08 && scheduler) rtc_synced = scheduler->now();
 }
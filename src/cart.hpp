@@ -19,11 +19,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define CART_HPP
 
 #include <array>
+#include <cstddef>
 #include <cstdint>
 #include <iosfwd>
 #include <string>
 #include <vector>
 
+class Scheduler;
+
 enum class CartController
 {
     ROM,
@@ -78,34 +81,102 @@ struct CartHeader
 class Cart
 {
 public:
+    // No cart, reads as 32K of 0xff. MBC3's clock counts the scheduler's
+    // cycles, without one it stands still.
+    explicit Cart(const Scheduler *scheduler = nullptr);
+    // The bank pointers are worked out again for the copy. Assigning keeps
+    // the scheduler.
+    Cart(const Cart &other);
+    Cart& operator=(const Cart &other);
+
+    // Follow with System::reset(), the MMU maps the ROM directly. Throws
+    // std::runtime_error for mappers that aren't supported, leaving the
+    // cart as it was.
     void loadCart(std::istream &cartFile);
     const CartHeader& getHeader() { return header; }
 
     void reset();
 
-    std::uint8_t readROM(std::uint16_t adr);
-    void writeROM(std::uint16_t adr, std::uint8_t val);
-
-    std::uint8_t readRAM(std::uint16_t adr);
-    void writeRAM(std::uint16_t adr, std::uint8_t val);
+    std::uint8_t readROM(std::uint16_t adr)
+    {
+        if (adr < 0x4000) return rom[adr];
+        return rom_bank[adr - 0x4000];
+    }
+    // ROM mapped at adr, or nullptr if the len bytes from there run past its
+    // half of the address space.
+    const std::uint8_t* mapROM(std::uint16_t adr, std::size_t len);
+    // Bank currently mapped at 0x4000-0x7fff.
+    std::size_t getROMBank() const { return rom_bank_base / 0x4000; }
+    void writeROM(std::uint16_t adr, std::uint8_t val) { (this->*write_control)(adr, val); }
+
+    std::uint8_t readRAM(std::uint16_t adr) { return (this->*read_ram)(adr); }
+    // RAM mapped at adr, or nullptr if it's switched off, the mapper does
+    // more than plain memory there or the len bytes from adr run past the
+    // end of it or the bank.
+    std::uint8_t* mapRAM(std::uint16_t adr, std::size_t len);
+    void writeRAM(std::uint16_t adr, std::uint8_t val) { (this->*write_ram)(adr, val); }
 
 private:
     CartHeader header;
 
-    enum class RamMode
-    {
-        OFF,
-        HALF,
-        ON,
-    };
-
     std::vector<uint8_t> rom;
-    std::size_t rom_bank_base;
     std::vector<uint8_t> ram;
-    RamMode ram_mode;
-    std::size_t ram_bank_base;
-
+    // One for each 8K of the control space, which is all most mappers
+    // decode.
     std::array<std::uint8_t, 4> ctrl_regs;
+    // MBC5's ninth ROM bank bit, written at 0x3000-0x3fff.
+    std::uint8_t rom_bank_high;
+
+    // MBC3's clock registers, seconds, minutes, hours, low and high day,
+    // as counted up to rtc_synced and as last latched.
+    std::array<std::uint8_t, 5> rtc_regs;
+    std::array<std::uint8_t, 5> rtc_latched;
+    // Register mapped in place of RAM, 0x08-0x0c, or 0 for RAM.
+    std::uint8_t rtc_select;
+    const Scheduler *scheduler;
+    std::uint64_t rtc_synced;
+
+    // The banks are kept as offsets, which stay right when the cart is
+    // copied, and as the pointers map_banks() works out from them, which
+    // the reads use.
+    std::size_t rom_bank_base;
+    std::size_t ram_bank_base;
+    bool ram_enabled;
+    const std::uint8_t *rom_bank;
+    std::uint8_t *ram_bank;     // nullptr while RAM is off or there is none.
+    std::size_t ram_window;     // Bytes of a RAM bank that are there.
+
+    // The mapper's handlers, bound once by bind_mapper() when the cart is
+    // loaded so accesses don't have to look at the cart type.
+    typedef void (Cart::*ControlWriter)(std::uint16_t adr, std::uint8_t val);
+    typedef std::uint8_t (Cart::*RAMReader)(std::uint16_t adr);
+    typedef void (Cart::*RAMWriter)(std::uint16_t adr, std::uint8_t val);
+    ControlWriter write_control;
+    RAMReader read_ram;
+    RAMWriter write_ram;
+    // Whether the MMU can map RAM straight in.
+    bool ram_direct;
+
+    void read_cart(std::istream &cartFile);
+    void bind_mapper();
+    void map_banks();
+    // Offset of bank, wrapped to the banks there are like the unconnected
+    // high bank lines would.
+    std::size_t rom_offset(std::size_t bank) const;
+    std::size_t ram_offset(std::size_t bank) const;
+    // Counts the clock up to now, before it's latched or written.
+    void sync_rtc();
+    void tick_rtc();
+
+    template<CartController controller> void write_control_regs(std::uint16_t adr, std::uint8_t val);
+    std::uint8_t read_ram_plain(std::uint16_t adr);
+    void write_ram_plain(std::uint16_t adr, std::uint8_t val);
+    // 512 half bytes, repeated through the whole RAM space.
+    std::uint8_t read_ram_mbc2(std::uint16_t adr);
+    void write_ram_mbc2(std::uint16_t adr, std::uint8_t val);
+    // RAM, or the selected clock register.
+    std::uint8_t read_ram_mbc3(std::uint16_t adr);
+    void write_ram_mbc3(std::uint16_t adr, std::uint8_t val);
 };
 
 #endif
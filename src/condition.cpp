@@ -0,0 +1,403 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "condition.hpp"
+
+#include <cctype>
+#include <sstream>
+#include <stdexcept>
+
+#include "cpu.hpp"
+#include "mmu.hpp"
+
+enum Op : std::uint8_t
+{
+    push_imm8,      // 1 byte operand.
+    push_imm16,     // 2 byte operand, low byte first.
+    push_const,     // 1 byte index into the constant pool.
+    push_reg,       // 1 byte Reg.
+    push_cycles,
+    load,           // Replaces an address with the byte there.
+    test,           // Replaces a value with 0 or 1.
+    pop,
+    jump_false,     // 2 byte target, taken if the top is 0 without popping it.
+    jump_true,      // Same, but taken if the top isn't 0.
+    op_not,
+    op_neg,
+    op_cpl,
+    op_add,
+    op_sub,
+    op_and,
+    op_or,
+    op_xor,
+    op_eq,
+    op_ne,
+    op_lt,
+    op_le,
+    op_gt,
+    op_ge,
+};
+
+enum Reg : std::uint8_t
+{
+    reg_A, reg_F, reg_B, reg_C, reg_D, reg_E, reg_H, reg_L,
+    reg_AF, reg_BC, reg_DE, reg_HL, reg_SP, reg_PC, reg_IME,
+};
+
+static const char *const reg_names[] =
+{
+    "A", "F", "B", "C", "D", "E", "H", "L",
+    "AF", "BC", "DE", "HL", "SP", "PC", "IME",
+};
+
+static std::int64_t read_reg(const CPUState &s, std::uint8_t reg)
+{
+    switch (reg)
+    {
+    case reg_A: return s.A;
+    case reg_F: return s.F;
+    case reg_B: return s.B;
+    case reg_C: return s.C;
+    case reg_D: return s.D;
+    case reg_E: return s.E;
+    case reg_H: return s.H;
+    case reg_L: return s.L;
+    case reg_AF: return (s.A << 8) | s.F;
+    case reg_BC: return (s.B << 8) | s.C;
+    case reg_DE: return (s.D << 8) | s.E;
+    case reg_HL: return (s.H << 8) | s.L;
+    case reg_SP: return s.SP;
+    case reg_PC: return s.PC;
+    default: return s.ime;
+    }
+}
+
+// Recursive descent, emitting code as it goes. Tracks how deep the stack
+// gets so evaluate() can use a fixed size one without checking, and how deep
+// the recursion gets so a long run of ( or ! can't overflow the native one.
+class Condition::Parser
+{
+public:
+    Parser(Condition &cond) :
+        cond(cond), text(cond.text), pos(0), depth(0), nesting(0)
+    {}
+
+    void parse()
+    {
+        parse_or();
+        skip_space();
+        if (pos != text.size()) fail("unexpected character");
+    }
+
+private:
+    Condition &cond;
+    const std::string &text;
+    std::size_t pos;
+    std::size_t depth;
+    std::size_t nesting;
+
+    static const std::size_t max_nesting = 64;
+
+    void fail(const char *msg)
+    {
+        std::ostringstream out;
+        out << "Bad condition at column " << pos + 1 << ": " << msg;
+        throw std::runtime_error(out.str());
+    }
+
+    void skip_space()
+    {
+        while (pos < text.size() && std::isspace((unsigned char)text[pos])) ++pos;
+    }
+
+    // Consumes tok if it's next.
+    bool accept(const char *tok)
+    {
+        skip_space();
+        std::size_t len = std::char_traits<char>::length(tok);
+        if (text.compare(pos, len, tok) != 0) return false;
+        pos += len;
+        return true;
+    }
+
+    void emit(std::uint8_t byte) { cond.code.push_back(byte); }
+
+    void emit_push()
+    {
+        if (++depth > max_stack) fail("too deeply nested");
+    }
+
+    void emit_binary(Op op)
+    {
+        emit(op);
+        --depth;
+    }
+
+    std::size_t emit_jump(Op op)
+    {
+        emit(op);
+        emit(0);
+        emit(0);
+        return cond.code.size() - 2;
+    }
+
+    void patch_jump(std::size_t at)
+    {
+        std::size_t target = cond.code.size();
+        if (target > 0xFFFF) fail("too long");
+        cond.code[at] = (std::uint8_t)target;
+        cond.code[at + 1] = (std::uint8_t)(target >> 8);
+    }
+
+    // a || b and a && b give 0 or 1 and skip b when a decides it.
+    void parse_or()
+    {
+        parse_and();
+        while (accept("||"))
+        {
+            emit(test);
+            std::size_t jump = emit_jump(jump_true);
+            emit(pop);
+            --depth;
+            parse_and();
+            emit(test);
+            patch_jump(jump);
+        }
+    }
+
+    void parse_and()
+    {
+        parse_compare();
+        while (accept("&&"))
+        {
+            emit(test);
+            std::size_t jump = emit_jump(jump_false);
+            emit(pop);
+            --depth;
+            parse_compare();
+            emit(test);
+            patch_jump(jump);
+        }
+    }
+
+    void parse_compare()
+    {
+        parse_arith();
+        for (;;)
+        {
+            // Two character operators first, so < doesn't eat <=.
+            if (accept("==")) { parse_arith(); emit_binary(op_eq); }
+            else if (accept("!=")) { parse_arith(); emit_binary(op_ne); }
+            else if (accept("<=")) { parse_arith(); emit_binary(op_le); }
+            else if (accept(">=")) { parse_arith(); emit_binary(op_ge); }
+            else if (accept("<")) { parse_arith(); emit_binary(op_lt); }
+            else if (accept(">")) { parse_arith(); emit_binary(op_gt); }
+            else break;
+        }
+    }
+
+    void parse_arith()
+    {
+        parse_unary();
+        for (;;)
+        {
+            skip_space();
+            // Leave || and && to the levels above.
+            if (text.compare(pos, 2, "||") == 0 || text.compare(pos, 2, "&&") == 0) break;
+
+            if (accept("+")) { parse_unary(); emit_binary(op_add); }
+            else if (accept("-")) { parse_unary(); emit_binary(op_sub); }
+            else if (accept("&")) { parse_unary(); emit_binary(op_and); }
+            else if (accept("|")) { parse_unary(); emit_binary(op_or); }
+            else if (accept("^")) { parse_unary(); emit_binary(op_xor); }
+            else break;
+        }
+    }
+
+    // Every unary operator, ( and [ comes back through here.
+    void parse_unary()
+    {
+        if (++nesting > max_nesting) fail("too deeply nested");
+
+        skip_space();
+        // Don't take the ! of a != that's missing its left side.
+        if (text.compare(pos, 2, "!=") != 0 && accept("!")) { parse_unary(); emit(op_not); }
+        else if (accept("-")) { parse_unary(); emit(op_neg); }
+        else if (accept("~")) { parse_unary(); emit(op_cpl); }
+        else parse_primary();
+
+        --nesting;
+    }
+
+    void parse_primary()
+    {
+        skip_space();
+        if (accept("("))
+        {
+            parse_or();
+            if (!accept(")")) fail("expected )");
+        }
+        else if (accept("["))
+        {
+            parse_or();
+            if (!accept("]")) fail("expected ]");
+            emit(load);
+        }
+        else if (pos < text.size() && (std::isdigit((unsigned char)text[pos]) || text[pos] == '$'))
+        {
+            parse_number();
+        }
+        else if (pos < text.size() && std::isalpha((unsigned char)text[pos]))
+        {
+            parse_name();
+        }
+        else
+        {
+            fail(pos < text.size() ? "expected a value" : "unexpected end");
+        }
+    }
+
+    void parse_number()
+    {
+        int base = 10;
+        if (text[pos] == '$')
+        {
+            base = 16;
+            ++pos;
+        }
+        else if (text.compare(pos, 2, "0x") == 0 || text.compare(pos, 2, "0X") == 0)
+        {
+            base = 16;
+            pos += 2;
+        }
+
+        std::uint64_t val = 0;
+        std::size_t start = pos;
+        while (pos < text.size() && std::isxdigit((unsigned char)text[pos]))
+        {
+            int digit = std::isdigit((unsigned char)text[pos]) ?
+                text[pos] - '0' :
+                std::toupper((unsigned char)text[pos]) - 'A' + 10;
+            if (digit >= base) break;
+            if (val > 0xFFFFFFFFFFFFull) fail("number too big");
+            val = val * base + digit;
+            ++pos;
+        }
+        if (pos == start) fail("expected digits");
+        if (pos < text.size() && std::isalnum((unsigned char)text[pos])) fail("bad digit");
+
+        emit_push();
+        if (val <= 0xFF)
+        {
+            emit(push_imm8);
+            emit((std::uint8_t)val);
+        }
+        else if (val <= 0xFFFF)
+        {
+            emit(push_imm16);
+            emit((std::uint8_t)val);
+            emit((std::uint8_t)(val >> 8));
+        }
+        else
+        {
+            if (cond.constants.size() > 0xFF) fail("too many constants");
+            emit(push_const);
+            emit((std::uint8_t)cond.constants.size());
+            cond.constants.push_back((std::int64_t)val);
+        }
+    }
+
+    void parse_name()
+    {
+        std::string name;
+        while (pos < text.size() && std::isalnum((unsigned char)text[pos]))
+        {
+            name += (char)std::toupper((unsigned char)text[pos]);
+            ++pos;
+        }
+
+        emit_push();
+        if (name == "CYCLES")
+        {
+            emit(push_cycles);
+            return;
+        }
+        for (std::uint8_t reg = 0; reg <= reg_IME; ++reg)
+        {
+            if (name == reg_names[reg])
+            {
+                emit(push_reg);
+                emit(reg);
+                return;
+            }
+        }
+        fail("unknown name");
+    }
+};
+
+Condition::Condition(const std::string &text) :
+    text(text)
+{
+    Parser(*this).parse();
+}
+
+bool Condition::evaluate(const CPUState &state, MMU &mmu, std::uint64_t cycles) const
+{
+    if (code.empty()) return true;
+
+    std::int64_t stack[max_stack];
+    std::int64_t *top = stack - 1;
+    const std::uint8_t *pc = code.data();
+    const std::uint8_t *end = pc + code.size();
+
+    while (pc != end)
+    {
+        switch (*pc++)
+        {
+        case push_imm8: *++top = pc[0]; pc += 1; break;
+        case push_imm16: *++top = pc[0] | (pc[1] << 8); pc += 2; break;
+        case push_const: *++top = constants[pc[0]]; pc += 1; break;
+        case push_reg: *++top = read_reg(state, pc[0]); pc += 1; break;
+        case push_cycles: *++top = (std::int64_t)cycles; break;
+        case load: *top = mmu.peek_mem((std::uint16_t)*top); break;
+        case test: *top = *top != 0; break;
+        case pop: --top; break;
+        case jump_false:
+            pc = *top ? pc + 2 : code.data() + (pc[0] | (pc[1] << 8));
+            break;
+        case jump_true:
+            pc = *top ? code.data() + (pc[0] | (pc[1] << 8)) : pc + 2;
+            break;
+        case op_not: *top = !*top; break;
+        case op_neg: *top = -*top; break;
+        case op_cpl: *top = ~*top; break;
+        case op_add: top[-1] += top[0]; --top; break;
+        case op_sub: top[-1] -= top[0]; --top; break;
+        case op_and: top[-1] &= top[0]; --top; break;
+        case op_or: top[-1] |= top[0]; --top; break;
+        case op_xor: top[-1] ^= top[0]; --top; break;
+        case op_eq: top[-1] = top[-1] == top[0]; --top; break;
+        case op_ne: top[-1] = top[-1] != top[0]; --top; break;
+        case op_lt: top[-1] = top[-1] < top[0]; --top; break;
+        case op_le: top[-1] = top[-1] <= top[0]; --top; break;
+        case op_gt: top[-1] = top[-1] > top[0]; --top; break;
+        case op_ge: top[-1] = top[-1] >= top[0]; --top; break;
+        }
+    }
+
+    return *top != 0;
+}
@@ -0,0 +1,60 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CONDITION_HPP
+#define CONDITION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class MMU;
+struct CPUState;
+
+// A breakpoint or watchpoint condition such as "A == 0 && [0xc0f3] > 5",
+// compiled once to a small stack bytecode so checking it is cheap.
+//
+// Operands are numbers (0x for hex), the registers A F B C D E H L AF BC DE
+// HL SP PC and IME, CYCLES for the machine cycle count, and [adr] for the
+// byte at adr. Operators, loosest first, are || && then the comparisons
+// == != < <= > >= then + - & | ^ (left to right, no precedence between
+// them) then the unary ! - ~. Parentheses group as usual.
+class Condition
+{
+public:
+    // Always holds.
+    Condition() {}
+    // Throws std::runtime_error if text isn't a valid condition.
+    explicit Condition(const std::string &text);
+
+    bool empty() const { return code.empty(); }
+    const std::string& getText() const { return text; }
+
+    bool evaluate(const CPUState &state, MMU &mmu, std::uint64_t cycles) const;
+
+private:
+    static const std::size_t max_stack = 16;
+
+    std::string text;
+    std::vector<std::uint8_t> code;
+    std::vector<std::int64_t> constants;
+
+    class Parser;
+};
+
+#endif
@@ -0,0 +1,39 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+// The whole core as one translation unit, so the compiler sees through the
+// calls between components (CPU to MMU to cart and so on) and can inline
+// them. The build compiles only this file, so new source files have to be
+// added here, and names local to a file have to be unique across all of them.
+
+#include "aot_library.cpp"
+#include "block_cache.cpp"
+#include "breakpoint_set.cpp"
+#include "cart.cpp"
+#include "condition.cpp"
+#include "cpu.cpp"
+#include "gpu.cpp"
+#include "instructions.cpp"
+#include "interpreter.cpp"
+#include "interrupt_controller.cpp"
+#include "jit.cpp"
+#include "mmu.cpp"
+#include "recompiler.cpp"
+#include "scheduler.cpp"
+#include "system.cpp"
+#include "timer.cpp"
@@ -18,121 +18,207 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "cpu.hpp"
 
 #include <cassert>
+#include <stdexcept>
 
+#include "alu_tables.hpp"
+#include "attention.hpp"
 #include "interrupt_controller.hpp"
 #include "mmu.hpp"
-
-static std::uint16_t make16(std::uint8_t hi, std::uint8_t lo)
+#include "timer.hpp"
+
+// Registers are stored as words, with the halves accessed as bytes.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The CPU register file requires a little endian host."
+#endif
+
+static_assert((int)REG8::F == 2 * (int)REG16::AF && (int)REG8::A == (int)REG8::F + 1, "AF layout");
+static_assert((int)REG8::C == 2 * (int)REG16::BC && (int)REG8::B == (int)REG8::C + 1, "BC layout");
+static_assert((int)REG8::E == 2 * (int)REG16::DE && (int)REG8::D == (int)REG8::E + 1, "DE layout");
+static_assert((int)REG8::L == 2 * (int)REG16::HL && (int)REG8::H == (int)REG8::L + 1, "HL layout");
+static_assert((int)REG8::SPL == 2 * (int)REG16::SP && (int)REG8::SPH == (int)REG8::SPL + 1, "SP layout");
+static_assert((int)REG8::TL == 2 * (int)REG16::T && (int)REG8::TH == (int)REG8::TL + 1, "T layout");
+static_assert((int)REG8::PCL == 2 * (int)REG16::PC && (int)REG8::PCH == (int)REG8::PCL + 1, "PC layout");
+
+// Bits of each register that can actually be written, only the flags have any fixed bits.
+static const std::uint8_t r8_write_mask[16] = {
+    0x00, 0x00, CPU::all_flags_mask, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+static const std::uint16_t r16_write_mask[8] = {
+    0x0000, 0xFF00 | CPU::all_flags_mask, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF,
+};
+
+#ifndef NDEBUG
+// Step by step versions of the table driven ALU ops, to check the tables against.
+static bool check_alu_tables()
 {
-    return hi << 8 | lo;
+    const std::uint8_t z_mask = CPU::z_mask;
+    const std::uint8_t n_mask = CPU::n_mask;
+    const std::uint8_t h_mask = CPU::h_mask;
+    const std::uint8_t c_mask = CPU::c_mask;
+
+    for (unsigned i = 0; i < daa_table.size(); i++)
+    {
+        std::uint8_t F = (std::uint8_t)((i >> 4) & (n_mask | h_mask | c_mask));
+        std::uint16_t temp = i & 0xFF;
+
+        if (F & n_mask)
+        {
+            if (F & h_mask) temp -= 6;
+            if (F & c_mask) temp -= 6 << 4;
+        }
+        else
+        {
+            if ((F & h_mask) || (temp & 0xF) > 9) temp += 6;
+            if ((F & c_mask) || (temp & 0xFFF0) > (9 << 4)) temp += 6 << 4;
+            if (temp & 0x100) F |= c_mask;
+        }
+
+        std::uint8_t A = (std::uint8_t)temp;
+        F &= ~(z_mask | h_mask);
+        if (A == 0) F |= z_mask;
+
+        if (daa_table[i] != (A | F << 8)) return false;
+    }
+
+    for (unsigned i = 0; i < shift_table.size(); i++)
+    {
+        unsigned kind = i >> 9;
+        std::uint8_t val = (std::uint8_t)i;
+        bool left = kind == 0 || kind == 2 || kind == 4;
+        bool carry_out = !!(val & (left ? 0x80 : 0x01));
+        bool carry_in = (kind < 2) ? carry_out : !!(i & 0x100);
+
+        switch (kind)
+        {
+        case 0:
+        case 2:
+            val = (val << 1) | (carry_in ? 0x01 : 0);
+            break;
+        case 5:
+            carry_in = !!(val & 0x80);
+            // FALL-THROUGH
+        case 1:
+        case 3:
+            val = (val >> 1) | (carry_in ? 0x80 : 0);
+            break;
+        case 4:
+            val = val << 1;
+            break;
+        case 6:
+            val = (val >> 4) | (val << 4);
+            carry_out = false;
+            break;
+        case 7:
+            val = val >> 1;
+            break;
+        }
+
+        std::uint8_t F = 0;
+        if (val == 0) F |= z_mask;
+        if (carry_out) F |= c_mask;
+
+        if (shift_table[i] != (val | F << 8)) return false;
+    }
+
+    for (unsigned i = 0; i < 0x100; i++)
+    {
+        std::uint8_t val = (std::uint8_t)(i - 1);
+        std::uint8_t F = 0;
+        ++val;
+        if ((val & 0x0f) == 0) F |= h_mask;
+        if (val == 0) F |= z_mask;
+        if ((inc_dec_table[i] >> 8) != F) return false;
+
+        val = (std::uint8_t)(i + 1);
+        F = n_mask;
+        --val;
+        if ((val & 0xf) == 0xf) F |= h_mask;
+        if (val == 0) F |= z_mask;
+        if ((inc_dec_table[0x100 | i] >> 8) != F) return false;
+    }
+
+    return true;
 }
 
-static void break16(std::uint16_t val, std::uint8_t &hi, std::uint8_t &lo)
+static bool alu_tables_ok()
 {
-    lo = (std::uint8_t)val;
-    hi = (std::uint8_t)(val >> 8);
+    static const bool ok = check_alu_tables();
+    return ok;
 }
+#endif
 
 void CPU::reset()
 {
-    F = 0;
+    assert(alu_tables_ok());
 
-    A = 0;
-    B = 0;
-    C = 0;
-    D = 0;
-    E = 0;
-    H = 0;
-    L = 0;
+    for (std::uint16_t &reg : regs) reg = 0;
 
-    PC = 0x100;
-    SP = 0;
+    PC() = 0x100;
+    flag_op = FlagOp::none;
 
     ime = false;
-    halting = false;
+    set_halting(false);
     halt_bug = false;
-
-    ctrl = &instr.ops[0].front();
+    stopped = false;
+    attention->clear(Attention::stop);
+    pending_cycles = 0;
+    event_horizon = 0;
+    timed_read = false;
+    block_imm = nullptr;
+
+    aot_ctx.cpu = this;
+    aot_ctx.r8 = reinterpret_cast<std::uint8_t*>(regs);
+    aot_ctx.r16 = regs;
+    aot_ctx.cycles = &pending_cycles;
+    aot_ctx.ime = &ime;
+    aot_ctx.flag_op = reinterpret_cast<std::uint8_t*>(&flag_op);
+    aot_ctx.flag_a = &flag_a;
+    aot_ctx.flag_b = &flag_b;
+    aot_ctx.flag_result = &flag_result;
+    aot_ctx.flag_add = (std::uint8_t)FlagOp::add;
+    aot_ctx.flag_sub = (std::uint8_t)FlagOp::sub;
+    aot_ctx.flag_logic = (std::uint8_t)FlagOp::logic;
+    aot_ctx.h_mask = h_mask;
+    aot_ctx.interrupt_due = &jit_interrupt_due;
+    aot_ctx.run_op = &jit_run_op;
+
+    ctrl = instr->ops[0];
 }
 
 std::uint8_t CPU::getr8(REG8 reg)
 {
-    switch (reg)
-    {
-    case REG8::A: return A;
-    case REG8::F: return F;
-    case REG8::B: return B;
-    case REG8::C: return C;
-    case REG8::D: return D;
-    case REG8::E: return E;
-    case REG8::H: return H;
-    case REG8::L: return L;
-    case REG8::PCH: return (std::uint8_t)(PC >> 8);
-    case REG8::PCL: return (std::uint8_t)(PC);
-    case REG8::SPH: return (std::uint8_t)(SP >> 8);
-    case REG8::SPL: return (std::uint8_t)(SP);
-    case REG8::TH: return (std::uint8_t)(T >> 8);
-    case REG8::TL: return (std::uint8_t)(T);
-    default:
-        assert(false);
-        return 0;
-    }
+    assert(reg != REG8::none);
+    if (reg == REG8::F) return flags();
+    return r8(reg);
 }
 
 void CPU::setr8(REG8 reg, std::uint8_t val)
 {
-    switch (reg)
-    {
-    case REG8::A: A = val; break;
-    case REG8::F: F = val & all_flags_mask; break;
-    case REG8::B: B = val; break;
-    case REG8::C: C = val; break;
-    case REG8::D: D = val; break;
-    case REG8::E: E = val; break;
-    case REG8::H: H = val; break;
-    case REG8::L: L = val; break;
-    case REG8::PCH: PC = (PC & 0x00FF) | (val << 8); break;
-    case REG8::PCL: PC = (PC & 0xFF00) | val; break;
-    case REG8::SPH: SP = (SP & 0x00FF) | (val << 8); break;
-    case REG8::SPL: SP = (SP & 0xFF00) | val; break;
-    case REG8::TH: T = (T & 0x00FF) | (val << 8); break;
-    case REG8::TL: T = (T & 0xFF00) | val; break;
-    default:
-        assert(false);
-    }
+    assert(reg != REG8::none);
+    if (reg == REG8::F) flag_op = FlagOp::none;
+    r8(reg) = val & r8_write_mask[(int)reg];
 }
 
 std::uint16_t CPU::getr16(REG16 reg)
 {
+    // Plain registers are a single load, only the pseudo registers need any work.
+    if (reg < REG16::PC)
+    {
+        assert(reg != REG16::none);
+        if (reg == REG16::AF) flags();
+        return r16(reg);
+    }
+
     switch (reg)
     {
-    case REG16::AF: return make16(A, F);
-    case REG16::BC: return make16(B, C);
-    case REG16::DE: return make16(D, E);
-    case REG16::HL: return make16(H, L);
-    case REG16::HLP:
-        {
-            std::uint16_t val = make16(H, L);
-            break16(val + 1, H, L);
-            return val;
-        }
-    case REG16::HLM:
-        {
-            std::uint16_t val = make16(H, L);
-            break16(val - 1, H, L);
-            return val;
-        }
-    case REG16::PC:
-        {
-            std::uint16_t val = PC++;
-            if (halt_bug) PC--;
-            return val;
-        }
-    case REG16::SP: return SP;
-    case REG16::T: return T;
-    case REG16::TP1: return T + 1;
-    case REG16::OTL: return 0xFF00 + (T & 0xFF);
-    case REG16::OC: return 0xFF00 + C;
+    case REG16::PC: return next_pc();
+    case REG16::HLP: return r16(REG16::HL)++;
+    case REG16::HLM: return r16(REG16::HL)--;
+    case REG16::TP1: return T() + 1;
+    case REG16::OTL: return 0xFF00 + (T() & 0xFF);
+    case REG16::OC: return 0xFF00 + C();
     default:
         assert(false);
         return 0;
@@ -141,127 +227,37 @@ std::uint16_t CPU::getr16(REG16 reg)
 
 void CPU::setr16(REG16 reg, std::uint16_t val)
 {
-    switch (reg)
-    {
-    case REG16::AF: break16(val & (0xFF00 | all_flags_mask), A, F); break;
-    case REG16::BC: break16(val, B, C); break;
-    case REG16::DE: break16(val, D, E); break;
-    case REG16::HL: break16(val, H, L); break;
-    case REG16::PC: PC = val; break;
-    case REG16::SP: SP = val; break;
-    case REG16::T: T = val; break;
-    default:
-        assert(false);
-    }
+    // Pseudo registers can't be written.
+    assert(reg != REG16::none && reg <= REG16::PC);
+    if (reg == REG16::AF) flag_op = FlagOp::none;
+    r16(reg) = val & r16_write_mask[(int)reg];
 }
 
-void CPU::step()
+void CPU::alu8(ALU_OP op, bool with_carry, std::uint8_t src)
 {
-    std::uint8_t data_in = 0;
-
-    if (halting && !ic->interrupt_pending()) return;
-    halting = false;
-
-    if (ctrl->decode &&         // Can only interrupt at the end of an instruction.
-        ime &&                  // and only if interrupts are enabled.
-        ic->interrupt_pending())  // and only if an interrupt is actually pending.
-    {
-        T = ic->accept_interrupt();
-        ctrl = &instr.interrupt_op[0];
-    }
-
-    // Note, data is likely sampled at end of 3rd sub cycle
-    // https://forums.nesdev.com/viewtopic.php?f=20&t=14014
-    if (ctrl->read)
-    {
-        data_in = mmu->read_mem(getr16(ctrl->adr));
-        // Need an explicit check as here the reg can be none as a special case.
-        if (ctrl->mem_reg != REG8::none) setr8(ctrl->mem_reg, data_in);
-        if (ctrl->adr == REG16::SP) ++SP;
-    }
-
-    if (ctrl->write)
-    {
-        if (ctrl->adr == REG16::SP) --SP;
-        mmu->write_mem(getr16(ctrl->adr), getr8(ctrl->mem_reg));
-    }
-
-    if (ctrl->decode)
-    {
-        try
-        {
-            ctrl = &instr.ops[data_in].at(0);
-        }
-        catch (std::out_of_range&)
-        {
-            throw std::runtime_error("Unimplemented op code");
-        }
-    }
-    else if (ctrl->decode_cb)
-    {
-        ctrl = &instr.cb_ops[data_in][0];
-    }
-    else
-    {
-        ctrl++;
-    }
-
-    switch (ctrl->cond_op)
+    switch (op)
     {
-    case CONDITION::none:
-        break;
-    case CONDITION::NZ:
-        cond_flag = !(F & z_mask);
-        break;
-    case CONDITION::Z:
-        cond_flag = !!(F & z_mask);
-        break;
-    case CONDITION::NC:
-        cond_flag = !(F & c_mask);
-        break;
-    case CONDITION::C:
-        cond_flag = !!(F& c_mask);
-        break;
-    case CONDITION::always:
-        cond_flag = true;
-        break;
-    case CONDITION::check:
-        while (!cond_flag && ctrl->cond_op == CONDITION::check) ctrl++;
-        break;
-    }
-
-    if (ctrl->ld)
-    {
-        setr8(ctrl->dst, getr8(ctrl->src));
-    }
-
-    switch (ctrl->alu_op)
-    {
-    case ALU_OP::none:
-        break;
-
     case ALU_OP::cp:
     case ALU_OP::sub:
     case ALU_OP::add:
         {
-            bool carry = (ctrl->with_carry) ? !!(F & c_mask) : 0;
-            std::uint8_t src = getr8(ctrl->alu_r8);
-            F = 0;
+            bool carry = with_carry ? carry_flag() : 0;
+            flag_op = FlagOp::add;
 
-            if (ctrl->alu_op != ALU_OP::add)
+            if (op != ALU_OP::add)
             {
                 // This does a two's complement, the plus one is effectivly done by flipping the carry bit.
                 src = ~src;
                 carry = !carry;
-                F |= n_mask | h_mask | c_mask;
+                flag_op = FlagOp::sub;
             }
 
-            std::uint16_t result = (std::uint16_t)src + A + (carry ? 1 : 0);
-            if (result & 0x100) F ^= c_mask;
-            if (0x10 & (result ^ src ^ A)) F ^= h_mask;
-            if ((result & 0xFF) == 0) F |= z_mask;
+            std::uint16_t result = (std::uint16_t)src + A() + (carry ? 1 : 0);
+            flag_a = A();
+            flag_b = src;
+            flag_result = result;
 
-            if (ctrl->alu_op != ALU_OP::cp) A = (std::uint8_t)result;
+            if (op != ALU_OP::cp) A() = (std::uint8_t)result;
         }
         break;
 
@@ -269,265 +265,476 @@ void CPU::step()
     case ALU_OP::xor_op:
     case ALU_OP::or_op:
         {
-            std::uint8_t src = getr8(ctrl->alu_r8);
-            F = 0;
+            flag_op = FlagOp::logic;
+            flag_b = 0;
 
-            switch (ctrl->alu_op)
+            switch (op)
             {
             case ALU_OP::and_op:
-                F |= h_mask;
-                A &= src;
+                flag_b = h_mask;
+                A() &= src;
                 break;
             case ALU_OP::xor_op:
-                A ^= src;
+                A() ^= src;
                 break;
             case ALU_OP::or_op:
-                A |= src;
+                A() |= src;
                 break;
+            default:
+                assert(false);
             }
 
-            if (A == 0) F |= z_mask;
+            flag_result = A();
         }
         break;
 
-    case ALU_OP::inc:
-    case ALU_OP::dec:
-        {
-            std::uint8_t val = getr8(ctrl->alu_r8);
-            F &= ~(z_mask | n_mask | h_mask);
+    default:
+        assert(false);
+    }
+}
 
-            if (ctrl->alu_op == ALU_OP::inc)
-            {
-                ++val;
-                if ((val & 0x0f) == 0) F |= h_mask;
-            }
-            else
-            {
-                F |= n_mask;
-                --val;
-                if ((val & 0xf) == 0xf) F |= h_mask;
-            }
+std::uint8_t CPU::inc8(std::uint8_t val)
+{
+    // The carry is left alone, so it's the only part of the previous flags that needs to be kept.
+    flag_b = carry_flag() ? c_mask : 0;
+    flag_op = FlagOp::inc;
+    ++val;
+    flag_result = val;
+    return val;
+}
 
-            if (val == 0) F |= z_mask;
-            setr8(ctrl->alu_r8, val);
-        }
-        break;
+std::uint8_t CPU::dec8(std::uint8_t val)
+{
+    flag_b = carry_flag() ? c_mask : 0;
+    flag_op = FlagOp::dec;
+    --val;
+    flag_result = val;
+    return val;
+}
 
-    case ALU_OP::daa:
-        {
-            std::uint16_t temp = A;
+bool CPU::carry_flag()
+{
+    switch (flag_op)
+    {
+    case FlagOp::add:
+        return !!(flag_result & 0x100);
+    case FlagOp::sub:
+        // The carry is inverted for subtraction, see alu8().
+        return !(flag_result & 0x100);
+    case FlagOp::logic:
+        return false;
+    case FlagOp::inc:
+    case FlagOp::dec:
+        return flag_b != 0;
+    default:
+        return !!(F() & c_mask);
+    }
+}
 
-            if (F & n_mask)
-            {
-                if (F & h_mask)
-                {
-                    temp -= 6;
-                }
-
-                if (F & c_mask)
-                {
-                    temp -= 6 << 4;
-                }
-            }
-            else
-            {
-                if ((F & h_mask) || (temp & 0xF) > 9)
-                {
-                    temp += 6;
-                }
-
-                if ((F & c_mask) || (temp & 0xFFF0) > (9 << 4))
-                {
-                    temp += 6 << 4;
-                }
-                if (temp & 0x100) F |= c_mask;
-            }
+void CPU::resolve_flags()
+{
+    std::uint8_t f = 0;
 
-            A = (std::uint8_t) temp;
-            F &= ~(z_mask | h_mask);
-            if (A == 0) F |= z_mask;
-        }
+    switch (flag_op)
+    {
+    case FlagOp::none:
+        return;
+
+    case FlagOp::sub:
+        f = n_mask | h_mask | c_mask;
+        // FALL-THROUGH
+    case FlagOp::add:
+        if (flag_result & 0x100) f ^= c_mask;
+        if (0x10 & (flag_result ^ flag_b ^ flag_a)) f ^= h_mask;
         break;
 
-    case ALU_OP::cpl:
-        F |= n_mask | h_mask;
-        A = ~A;
+    case FlagOp::logic:
+        f = flag_b;
         break;
 
-    case ALU_OP::scf:
-        F &= ~(n_mask | h_mask);
-        F |= c_mask;
-        break;
+    case FlagOp::inc:
+    case FlagOp::dec:
+        f = flag_b | (inc_dec_table[(flag_op == FlagOp::dec ? 0x100 : 0) | flag_result] >> 8);
+        F() = f;
+        flag_op = FlagOp::none;
+        return;
+    }
 
-    case ALU_OP::ccf:
-        F &= ~(n_mask | h_mask);
-        F ^= c_mask;
-        break;
+    if ((flag_result & 0xFF) == 0) f |= z_mask;
 
-    case ALU_OP::rl:
-    case ALU_OP::rr:
-    case ALU_OP::sla:
-    case ALU_OP::sra:
-    case ALU_OP::srl:
-        {
-            bool left = false;
-            if (ctrl->alu_op == ALU_OP::rl || ctrl->alu_op == ALU_OP::sla) left = true;
+    F() = f;
+    flag_op = FlagOp::none;
+}
 
-            std::uint8_t val = getr8(ctrl->alu_r8);
-            bool carry_out = !!(val & (left ? 0x80 : 0x01));
-            bool carry_in = ctrl->with_carry ? carry_out : !!(F & c_mask);
+void CPU::daa()
+{
+    std::uint16_t entry = daa_table[(flags() & (n_mask | h_mask | c_mask)) << 4 | A()];
+    A() = (std::uint8_t)entry;
+    F() = (std::uint8_t)(entry >> 8);
+}
 
-            if (ctrl->alu_op == ALU_OP::sra) carry_in = !!(val & 0x80);
+void CPU::cpl()
+{
+    flags();
+    F() |= n_mask | h_mask;
+    A() = ~A();
+}
 
-            switch (ctrl->alu_op)
-            {
-            case ALU_OP::rl:
-                val = (val << 1) | (carry_in ? 0x01 : 0);
-                break;
-            case ALU_OP::sra:
-            case ALU_OP::rr:
-                val = (val >> 1) | (carry_in ? 0x80 : 0);
-                break;
-            case ALU_OP::sla:
-                val = val << 1;
-                break;
-            case ALU_OP::srl:
-                val = val >> 1;
-                break;
-            }
+void CPU::scf()
+{
+    flags();
+    F() &= ~(n_mask | h_mask);
+    F() |= c_mask;
+}
 
-            F = 0;
-            if (!ctrl->ignore_zero && val == 0) F |= z_mask;
-            if (carry_out) F |= c_mask;
-            setr8(ctrl->alu_r8, val);
-        }
-        break;
+void CPU::ccf()
+{
+    flags();
+    F() &= ~(n_mask | h_mask);
+    F() ^= c_mask;
+}
 
-    case ALU_OP::swap:
-        {
-            std::uint8_t val = getr8(ctrl->alu_r8);
-            F = 0;
-            val = (val >> 4) | (val << 4);
-            if (val == 0) F |= z_mask;
-            setr8(ctrl->alu_r8, val);
-        }
-        break;
+std::uint8_t CPU::shift8(ALU_OP op, bool with_carry, bool ignore_zero, std::uint8_t val)
+{
+    // rl through srl are in CB op code order, and the with_carry versions of rl/rr come first.
+    unsigned kind = (unsigned)op - (unsigned)ALU_OP::rl + (with_carry ? 0 : 2);
+    std::uint16_t entry = shift_table[kind << 9 | (carry_flag() ? 0x100 : 0) | val];
 
-    case ALU_OP::bit:
-        {
-            std::uint8_t val = getr8(ctrl->alu_r8);
-            F &= ~(z_mask | n_mask);
-            F |= h_mask;
-            if ((val & ctrl->mask) == 0) F |= z_mask;
-        }
-        break;
+    flag_op = FlagOp::none;
+    F() = (std::uint8_t)(entry >> 8) & (ignore_zero ? ~z_mask : 0xFF);
+    return (std::uint8_t)entry;
+}
+
+std::uint8_t CPU::swap8(std::uint8_t val)
+{
+    std::uint16_t entry = shift_table[swap_kind << 9 | val];
+
+    flag_op = FlagOp::none;
+    F() = (std::uint8_t)(entry >> 8);
+    return (std::uint8_t)entry;
+}
+
+void CPU::bit8(std::uint8_t mask, std::uint8_t val)
+{
+    flags();
+    F() &= ~(z_mask | n_mask);
+    F() |= h_mask;
+    if ((val & mask) == 0) F() |= z_mask;
+}
+
+std::uint16_t CPU::add_sp(std::uint8_t offset)
+{
+    std::uint16_t adjust = offset;
+    if (adjust & 0x80) adjust |= 0xFF00;
+
+    flag_op = FlagOp::none;
+    F() = 0;
+    std::uint16_t result = SP() + adjust;
+    if (0x0010 & (result ^ adjust ^ SP())) F() |= h_mask;
+    if (0x0100 & (result ^ adjust ^ SP())) F() |= c_mask;
+    return result;
+}
+
+void CPU::add_hl(std::uint16_t src)
+{
+    flags();
+    F() &= ~(n_mask | h_mask | c_mask);
+    std::uint32_t result = src + HL();
+
+    if (result & 0x10000) F() |= c_mask;
+    if (0x1000 & (result ^ src ^ (H() << 8))) F() |= h_mask;
+
+    HL() = (std::uint16_t)result;
+}
+
+// With GCC and Clang each handler jumps straight to the next one through a
+// label table, elsewhere a switch in a loop does the same job.
+#if defined(__GNUC__) || defined(__clang__)
+#define HANDLER(name) do_##name:
+#define DISPATCH() goto *labels[(int)*hp++]
+#else
+#define HANDLER(name) case Handler::name:
+#define DISPATCH() continue
+#endif
+
+void CPU::step()
+{
+    std::uint8_t data_in = 0;
+
+    // System moves the clock itself in this mode, so the instruction engine
+    // has to work out again when the next event is.
+    event_horizon = 0;
+
+    if ((attention->get() & Attention::cpu) && attend_cycle()) return;
+
+    const Handler *hp = Instructions::handlers(ctrl);
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_HANDLER_LABEL(name) &&do_##name,
+    static void *const labels[] = { CPU_HANDLERS(CPU_HANDLER_LABEL) };
+#undef CPU_HANDLER_LABEL
+    DISPATCH();
+    {
+#else
+    for (;;) switch (*hp++)
+    {
+#endif
+    // Note, data is likely sampled at end of 3rd sub cycle
+    // https://forums.nesdev.com/viewtopic.php?f=20&t=14014
+    HANDLER(next)
+        ctrl++;
+        hp = Instructions::handlers(ctrl) + 1;
+        DISPATCH();
+
+    HANDLER(read_next)
+        data_in = mmu->read_mem(getr16(ctrl->adr()));
+        // Need an explicit check as here the reg can be none as a special case.
+        if (ctrl->mem_reg() != REG8::none) setr8(ctrl->mem_reg(), data_in);
+        ctrl++;
+        hp = Instructions::handlers(ctrl) + 1;
+        DISPATCH();
+
+    HANDLER(read_sp_next)
+        data_in = mmu->read_mem(SP());
+        if (ctrl->mem_reg() != REG8::none) setr8(ctrl->mem_reg(), data_in);
+        ++SP();
+        ctrl++;
+        hp = Instructions::handlers(ctrl) + 1;
+        DISPATCH();
+
+    HANDLER(write_next)
+        mmu->write_mem(getr16(ctrl->adr()), getr8(ctrl->mem_reg()));
+        ctrl++;
+        hp = Instructions::handlers(ctrl) + 1;
+        DISPATCH();
+
+    HANDLER(write_sp_next)
+        mmu->write_mem(--SP(), getr8(ctrl->mem_reg()));
+        ctrl++;
+        hp = Instructions::handlers(ctrl) + 1;
+        DISPATCH();
 
-    case ALU_OP::res:
+    HANDLER(fetch_decode)
         {
-            std::uint8_t val = getr8(ctrl->alu_r8);
-            val &= ~(ctrl->mask);
-            setr8(ctrl->alu_r8, val);
+            data_in = mmu->read_mem(getr16(ctrl->adr()));
+            const MicroOp *next = instr->ops[data_in];
+            if (!next) throw std::runtime_error("Unimplemented op code");
+            ctrl = next;
+            hp = Instructions::handlers(ctrl) + 1;
         }
-        break;
+        DISPATCH();
+
+    HANDLER(fetch_decode_cb)
+        data_in = mmu->read_mem(getr16(ctrl->adr()));
+        ctrl = instr->cb_ops[data_in];
+        hp = Instructions::handlers(ctrl) + 1;
+        DISPATCH();
+
+    HANDLER(cond_nz)
+        cond_flag = !(flags() & z_mask);
+        DISPATCH();
+
+    HANDLER(cond_z)
+        cond_flag = !!(flags() & z_mask);
+        DISPATCH();
+
+    HANDLER(cond_nc)
+        cond_flag = !(flags() & c_mask);
+        DISPATCH();
+
+    HANDLER(cond_c)
+        cond_flag = !!(flags() & c_mask);
+        DISPATCH();
+
+    HANDLER(cond_always)
+        cond_flag = true;
+        DISPATCH();
 
-    case ALU_OP::set:
+    HANDLER(cond_check)
+        if (!cond_flag)
         {
-            std::uint8_t val = getr8(ctrl->alu_r8);
-            val |= ctrl->mask;
-            setr8(ctrl->alu_r8, val);
+            // Skip the rest of the taken branch, then carry on with whatever
+            // stages the op after it has past its condition.
+            while (ctrl->cond_op() == CONDITION::check) ctrl++;
+            hp = Instructions::handlers(ctrl) + 1;
+            if (ctrl->cond_op() != CONDITION::none) hp++;
         }
-        break;
+        DISPATCH();
 
-    case ALU_OP::sp_adjust:
-        {
-            std::uint16_t adjust = T & 0xFF;
-            if (adjust & 0x80) adjust |= 0xFF00;
+    HANDLER(ld)
+        setr8(ctrl->dst(), getr8(ctrl->src()));
+        DISPATCH();
 
-            F = 0;
-            std::uint16_t result = SP + adjust;
-            if (0x0010 & (result ^ adjust ^ SP)) F |= h_mask;
-            if (0x0100 & (result ^ adjust ^ SP)) F |= c_mask;
+    HANDLER(alu8)
+        alu8(ctrl->alu_op(), ctrl->with_carry(), getr8(ctrl->alu_r8()));
+        DISPATCH();
 
-            setr16(ctrl->alu_r16, result);
-        }
-        break;
+    HANDLER(inc)
+        setr8(ctrl->alu_r8(), inc8(getr8(ctrl->alu_r8())));
+        DISPATCH();
+
+    HANDLER(dec)
+        setr8(ctrl->alu_r8(), dec8(getr8(ctrl->alu_r8())));
+        DISPATCH();
+
+    HANDLER(daa)
+        daa();
+        DISPATCH();
+
+    HANDLER(cpl)
+        cpl();
+        DISPATCH();
 
-    case ALU_OP::pc_adjust:
+    HANDLER(scf)
+        scf();
+        DISPATCH();
+
+    HANDLER(ccf)
+        ccf();
+        DISPATCH();
+
+    HANDLER(shift)
+        setr8(ctrl->alu_r8(), shift8(ctrl->alu_op(), ctrl->with_carry(), ctrl->ignore_zero(), getr8(ctrl->alu_r8())));
+        DISPATCH();
+
+    HANDLER(swap)
+        setr8(ctrl->alu_r8(), swap8(getr8(ctrl->alu_r8())));
+        DISPATCH();
+
+    HANDLER(bit)
+        bit8(ctrl->mask(), getr8(ctrl->alu_r8()));
+        DISPATCH();
+
+    HANDLER(res)
+        setr8(ctrl->alu_r8(), getr8(ctrl->alu_r8()) & ~ctrl->mask());
+        DISPATCH();
+
+    HANDLER(set)
+        setr8(ctrl->alu_r8(), getr8(ctrl->alu_r8()) | ctrl->mask());
+        DISPATCH();
+
+    HANDLER(sp_adjust)
+        setr16(ctrl->alu_r16(), add_sp((std::uint8_t)T()));
+        DISPATCH();
+
+    HANDLER(pc_adjust)
         {
-            std::uint16_t adjust = T & 0xFF;
+            std::uint16_t adjust = T() & 0xFF;
             if (adjust & 0x80) adjust |= 0xFF00;
-            PC += adjust;
+            PC() += adjust;
         }
-        break;
+        DISPATCH();
 
-    case ALU_OP::pc_set:
-        PC = getr16(ctrl->alu_r16);
-        break;
+    HANDLER(pc_set)
+        PC() = getr16(ctrl->alu_r16());
+        DISPATCH();
 
-    case ALU_OP::pc_reset:
-        PC = ctrl->mask;
-        break;
+    HANDLER(pc_reset)
+        PC() = ctrl->mask();
+        DISPATCH();
 
-    case ALU_OP::inc16:
-        setr16(ctrl->alu_r16, getr16(ctrl->alu_r16) + 1);
-        break;
+    HANDLER(inc16)
+        setr16(ctrl->alu_r16(), getr16(ctrl->alu_r16()) + 1);
+        DISPATCH();
 
-    case ALU_OP::dec16:
-        setr16(ctrl->alu_r16, getr16(ctrl->alu_r16) - 1);
-        break;
+    HANDLER(dec16)
+        setr16(ctrl->alu_r16(), getr16(ctrl->alu_r16()) - 1);
+        DISPATCH();
 
-    case ALU_OP::add16:
-        {
-            F &= ~(n_mask | h_mask | c_mask);
-            std::uint16_t src = getr16(ctrl->alu_r16);
-            std::uint32_t result = src + make16(H, L);
+    HANDLER(add16)
+        add_hl(getr16(ctrl->alu_r16()));
+        DISPATCH();
 
-            if (result & 0x10000) F |= c_mask;
-            if (0x1000 & (result ^ src ^ (H << 8))) F |= h_mask;
+    HANDLER(ei)
+        ime = true;
+        DISPATCH();
 
-            break16((std::uint16_t)result, H, L);
-        }
-        break;
+    HANDLER(di)
+        ime = false;
+        DISPATCH();
+
+    HANDLER(halt)
+        if (!ime && ic->interrupt_pending()) halt_bug = true;
+        set_halting(!ic->interrupt_pending());
+        DISPATCH();
+
+    HANDLER(stop)
+        stop();
+        DISPATCH();
+
+    HANDLER(end)
+        return;
     }
+}
+
+#undef HANDLER
+#undef DISPATCH
 
-    switch (ctrl->sys_op)
+bool CPU::attend_cycle()
+{
+    if (isStopped()) return true;
+    if (halting && !ic->interrupt_pending()) return true;
+    set_halting(false);
+
+    if (ctrl->decode() &&       // Can only interrupt at the end of an instruction.
+        ime &&                  // and only if interrupts are enabled.
+        ic->interrupt_pending())  // and only if an interrupt is actually pending.
     {
-    case SYS_OP::ei:
-        ime = true;
-        break;
-    case SYS_OP::di:
-        ime = false;
-        break;
-    case SYS_OP::halt:
-        if (!ime && ic->interrupt_pending()) halt_bug = true;
-        halting = !ic->interrupt_pending();
-        break;
-    case SYS_OP::stop:
-        assert(false);
-        break;
+        T() = ic->accept_interrupt();
+        ctrl = instr->interrupt_op;
     }
+    return false;
+}
+
+bool CPU::isStopped()
+{
+    // There's no joypad yet, a request for its interrupt stands in for the
+    // button press. It ends STOP mode whether or not it's enabled.
+    if (stopped && ic->joypad_requested())
+    {
+        stopped = false;
+        attention->clear(Attention::stop);
+        timer->resume();
+    }
+    return stopped;
+}
+
+void CPU::set_halting(bool val)
+{
+    halting = val;
+    attention->assign(Attention::halt, val);
+}
+
+void CPU::stop()
+{
+    // DIV is reset on entering STOP mode, and stays there.
+    timer->setDIV(0);
+    timer->pause();
+    stopped = true;
+    attention->set(Attention::stop);
 }
 
 CPUState CPU::getState()
 {
     // Can only get the state between instructions.
-    assert(ctrl->decode);
-    return CPUState{ A, F, B, C, D, E, H, L, PC, SP, ime };
+    assert(ctrl->decode());
+    return CPUState{ A(), flags(), B(), C(), D(), E(), H(), L(), PC(), SP(), ime };
 }
 
 void CPU::setState(const CPUState& state)
 {
     // Can only change state between instructions.
-    assert(ctrl->decode);
-    A = state.A;
-    F = state.F;
-    B = state.B;
-    C = state.C;
-    D = state.D;
-    E = state.E;
-    H = state.H;
-    L = state.L;
-    PC = state.PC;
-    SP = state.SP;
+    assert(ctrl->decode());
+    A() = state.A;
+    F() = state.F;
+    flag_op = FlagOp::none;
+    B() = state.B;
+    C() = state.C;
+    D() = state.D;
+    E() = state.E;
+    H() = state.H;
+    L() = state.L;
+    PC() = state.PC;
+    SP() = state.SP;
     ime = state.ime;
 }
@@ -20,11 +20,20 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <cstddef>
 #include <cstdint>
+#include <exception>
 
+#include "aot.hpp"
 #include "instructions.hpp"
 
+struct Block;
+struct BlockOp;
+class Attention;
+class BlockCache;
+class JIT;
 class MMU;
 class InterruptController;
+class Scheduler;
+class Timer;
 
 struct CPUState
 {
@@ -53,50 +62,220 @@ public:
     static const std::uint8_t all_flags_mask =
         z_mask | n_mask | h_mask | c_mask;
 
-    CPU(MMU *mmu, InterruptController *ic) :
-        mmu(mmu), ic(ic)
+    // Most cycles an idle CPU is skipped ahead by in one go, for when nothing
+    // is coming to wake it up.
+    static const std::uint32_t max_idle_skip = 1 << 20;
+
+    CPU(MMU *mmu, InterruptController *ic, Attention *attention, Scheduler *scheduler, Timer *timer, BlockCache *blocks, JIT *jit) :
+        mmu(mmu), attention(attention), scheduler(scheduler),
+        instr(&Instructions::get()), ic(ic), timer(timer), blocks(blocks), jit(jit)
     {}
 
     void reset();
+
+    // Run a single machine cycle from the microcode table.
     void step();
+    // Run a whole instruction (or interrupt dispatch) at once, moving the
+    // scheduler's clock itself. Only valid between instructions.
+    void execute();
+    // Same as calling execute() until the attention word has one of the
+    // Attention::run_stop flags set, without the calls or keeping the
+    // scheduler's clock in step between instructions.
+    void run_instructions();
+    // Run a cached block of instructions, or a single instruction where
+    // there's no block to run. Blocks found in an AOT plugin run the plugin's
+    // code instead. Only valid between instructions.
+    void run_block();
+    // Same as run_block(), but blocks that have been run often enough are
+    // compiled to native code first.
+    void run_jit();
+
+    // Makes the instruction engine look up the next event again, for when
+    // one is scheduled from outside the CPU.
+    void events_changed() { event_horizon = 0; }
 
     CPUState getState();
     void setState(const CPUState &state);
 
-    std::uint16_t getPC() { return PC; }
-    bool isFetching() { return ctrl->decode; }
+    std::uint16_t getPC() { return PC(); }
+    bool isFetching() { return ctrl->decode(); }
+    bool isHalting() const { return halting; }
+    // Whether the CPU is in STOP mode. Nothing runs, not even the timer, until
+    // a button press ends it.
+    bool isStopped();
 
 private:
-    const Instructions instr;
+    friend class JIT;
 
-    std::uint8_t A;
-    std::uint8_t F;
-    std::uint8_t B;
-    std::uint8_t C;
-    std::uint8_t D;
-    std::uint8_t E;
-    std::uint8_t H;
-    std::uint8_t L;
+    // Runs a block needs before it's worth compiling.
+    static const std::uint32_t jit_threshold = 16;
 
-    std::uint16_t PC;
-    std::uint16_t SP;
+    // Fields are ordered so that what every instruction touches, up to ctrl,
+    // fits in the first 64 bytes.
+
+    // Register file, indexed by REG16 for the plain 16-bit registers. The 8-bit
+    // halves are accessed through the same storage, indexed by REG8.
+    std::uint16_t regs[8];
+
+    std::uint8_t& r8(REG8 reg) { return reinterpret_cast<std::uint8_t*>(regs)[(int)reg]; }
+    std::uint16_t& r16(REG16 reg) { return regs[(int)reg]; }
+
+    std::uint8_t& A() { return r8(REG8::A); }
+    std::uint8_t& F() { return r8(REG8::F); }
+    std::uint8_t& B() { return r8(REG8::B); }
+    std::uint8_t& C() { return r8(REG8::C); }
+    std::uint8_t& D() { return r8(REG8::D); }
+    std::uint8_t& E() { return r8(REG8::E); }
+    std::uint8_t& H() { return r8(REG8::H); }
+    std::uint8_t& L() { return r8(REG8::L); }
+
+    std::uint16_t& HL() { return r16(REG16::HL); }
+    std::uint16_t& PC() { return r16(REG16::PC); }
+    std::uint16_t& SP() { return r16(REG16::SP); }
+    std::uint16_t& T() { return r16(REG16::T); }
 
     bool ime;
 
+    // Flags of the common ALU ops are evaluated lazily. The op and its operands
+    // are recorded, and F is only brought up to date once something reads it.
+    enum class FlagOp : std::uint8_t
+    {
+        none,   // F is up to date.
+        add,
+        sub,
+        logic,
+        inc,
+        dec,
+    };
+
+    FlagOp flag_op;
+    std::uint8_t flag_a;
+    std::uint8_t flag_b;
+    std::uint16_t flag_result;
+
+    std::uint8_t flags()
+    {
+        if (flag_op != FlagOp::none) resolve_flags();
+        return F();
+    }
+
+    void resolve_flags();
+    bool carry_flag();
+
     MMU *mmu;
-    InterruptController *ic;
+    Attention *attention;
+    Scheduler *scheduler;
+
+    // The instruction engine counts up machine cycles and only hands them to
+    // the scheduler when something could tell the difference: an I/O access, a
+    // HALT, or the end of the instruction or block. Until event_horizon cycles
+    // have passed no event can raise an interrupt.
+    std::uint32_t pending_cycles;
+    std::uint32_t event_horizon;
+
+    const MicroOp *ctrl;
 
-    const CPU_Control *ctrl;
+    const Instructions *instr;
+    InterruptController *ic;
+    Timer *timer;
+    BlockCache *blocks;
+    JIT *jit;
 
-    std::uint16_t T;
     bool cond_flag;
     bool halting;
     bool halt_bug;
+    bool stopped;
+
+    // Keep the attention word in step with halting and stopped.
+    void set_halting(bool val);
+    void stop();
+
+    // Slow paths for when the attention word has one of the CPU's flags set.
+    // Both return true if that used up the cycle or instruction, either
+    // because the CPU is idle or, for attend_instruction(), because an
+    // interrupt was dispatched.
+    bool attend_cycle();
+    bool attend_instruction();
+
+    static std::uint16_t make16(std::uint8_t hi, std::uint8_t lo)
+    {
+        return hi << 8 | lo;
+    }
+
+    std::uint16_t next_pc()
+    {
+        std::uint16_t val = PC()++;
+        if (halt_bug) PC()--;
+        return val;
+    }
 
     std::uint8_t getr8(REG8 reg);
     void setr8(REG8 reg, std::uint8_t val);
     std::uint16_t getr16(REG16 reg);
     void setr16(REG16 reg, std::uint16_t val);
+
+    // ALU operations shared by the microcode and instruction engines.
+    void alu8(ALU_OP op, bool with_carry, std::uint8_t src);
+    std::uint8_t inc8(std::uint8_t val);
+    std::uint8_t dec8(std::uint8_t val);
+    void daa();
+    void cpl();
+    void scf();
+    void ccf();
+    std::uint8_t shift8(ALU_OP op, bool with_carry, bool ignore_zero, std::uint8_t val);
+    std::uint8_t swap8(std::uint8_t val);
+    void bit8(std::uint8_t mask, std::uint8_t val);
+    std::uint16_t add_sp(std::uint8_t offset);
+    void add_hl(std::uint16_t src);
+
+    // Machine cycles run so far, for measuring how long things take.
+    std::uint64_t cycle_count() const;
+
+    void tick() { ++pending_cycles; }
+    // execute() without bringing the clock up to date at the end.
+    void execute_unsynced();
+    void sync_clock();
+    bool interrupt_due();
+    static bool is_io(std::uint16_t adr) { return (adr & 0xFF80) == 0xFF00; }
+    // Passes of a loop that can be skipped without missing an interrupt check
+    // that would pass, or an event raising an interrupt.
+    std::uint32_t passes_to_horizon(std::uint32_t cycles_per_pass) const;
+
+    // Immediate bytes of the running block op.
+    const std::uint8_t *block_imm;
+
+    Block* find_block();
+    void interpret_block(const Block &block);
+    void run_idiom(const Block &block);
+    void run_poll(const Block &block);
+    // Set by reads of anything that changes with time, see MMU::is_timed().
+    bool timed_read;
+    void run_aot(const Block &block);
+    void finish_native();
+
+    // Called from compiled code. Both return true when the block has to stop,
+    // exceptions are kept in jit_error until the code has returned.
+    static bool jit_interrupt_due(CPU *cpu);
+    static bool jit_run_op(CPU *cpu, const BlockOp *op);
+    std::exception_ptr jit_error;
+
+    AOTContext aot_ctx;
+
+    // Helpers for the instruction engine, each one takes a machine cycle.
+    std::uint8_t read_cycle(std::uint16_t adr);
+    void write_cycle(std::uint16_t adr, std::uint8_t val);
+    void idle_cycle() { tick(); }
+    // Ops run from a block take their immediates from block_imm instead of
+    // reading them.
+    template<bool cached> std::uint8_t imm8();
+
+    std::uint8_t read_r8(int bits);
+    void write_r8(int bits, std::uint8_t val);
+    bool check_cond(int bits);
+    void push16(std::uint16_t val);
+    std::uint16_t pop16();
+    template<bool cached> void execute_op(std::uint8_t op_code);
+    template<bool cached> void execute_cb();
 };
 
 #endif
@@ -27,6 +27,10 @@ public:
     std::uint8_t readVRAM(std::uint16_t adr);
     void writeVRAM(std::uint16_t adr, std::uint8_t val);
 
+    // VRAM is always accessible for now, there's no PPU timing yet to lock
+    // it.
+    std::uint8_t* mapVRAM(std::uint16_t adr) { return vram.data() + adr; }
+
     std::uint8_t readOAM(std::uint16_t adr);
     void writeOAM(std::uint16_t adr, std::uint8_t val);
 
@@ -21,6 +21,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <stdexcept>
 
 static void reset(CPU_Control &ctrl)
 {
@@ -225,6 +226,131 @@ static void check_op(const CPU_Control& ctrl)
     }
 }
 
+PackedControl::PackedControl(const CPU_Control &ctrl) :
+    bits(0)
+{
+    auto put = [this](unsigned pos, unsigned width, std::uint32_t val)
+    {
+        // Make sure the enums haven't outgrown their fields.
+        assert(val < (1u << width));
+        bits |= (std::uint64_t)val << pos;
+    };
+
+    put(0, 1, ctrl.read);
+    put(1, 1, ctrl.write);
+    put(2, 1, ctrl.decode);
+    put(3, 1, ctrl.decode_cb);
+    put(4, 1, ctrl.ld);
+    put(5, 1, ctrl.with_carry);
+    put(6, 1, ctrl.ignore_zero);
+
+    put(8, 4, (std::uint32_t)ctrl.adr);
+    put(12, 4, (std::uint32_t)ctrl.mem_reg);
+    put(16, 4, (std::uint32_t)ctrl.src);
+    put(20, 4, (std::uint32_t)ctrl.dst);
+    put(24, 4, (std::uint32_t)ctrl.alu_r16);
+    put(28, 4, (std::uint32_t)ctrl.alu_r8);
+
+    put(32, 5, (std::uint32_t)ctrl.alu_op);
+    put(40, 3, (std::uint32_t)ctrl.cond_op);
+    put(44, 3, (std::uint32_t)ctrl.sys_op);
+    put(48, 8, ctrl.mask);
+}
+
+HandlerList MicroOp::make_handlers(const CPU_Control &ctrl)
+{
+    HandlerList handlers;
+    std::size_t count = 0;
+    auto add = [&handlers, &count](Handler h)
+    {
+        assert(count < handlers.size());
+        handlers[count++] = h;
+    };
+
+    if (ctrl.decode)
+    {
+        assert(ctrl.read && !ctrl.write && ctrl.mem_reg == REG8::none);
+        add(Handler::fetch_decode);
+    }
+    else if (ctrl.decode_cb)
+    {
+        assert(ctrl.read && !ctrl.write && ctrl.mem_reg == REG8::none);
+        add(Handler::fetch_decode_cb);
+    }
+    else if (ctrl.read)
+    {
+        assert(!ctrl.write);
+        add(ctrl.adr == REG16::SP ? Handler::read_sp_next : Handler::read_next);
+    }
+    else if (ctrl.write)
+    {
+        add(ctrl.adr == REG16::SP ? Handler::write_sp_next : Handler::write_next);
+    }
+    else
+    {
+        add(Handler::next);
+    }
+
+    switch (ctrl.cond_op)
+    {
+    case CONDITION::none: break;
+    case CONDITION::NZ: add(Handler::cond_nz); break;
+    case CONDITION::Z: add(Handler::cond_z); break;
+    case CONDITION::NC: add(Handler::cond_nc); break;
+    case CONDITION::C: add(Handler::cond_c); break;
+    case CONDITION::always: add(Handler::cond_always); break;
+    case CONDITION::check: add(Handler::cond_check); break;
+    }
+
+    if (ctrl.ld) add(Handler::ld);
+
+    switch (ctrl.alu_op)
+    {
+    case ALU_OP::none: break;
+    case ALU_OP::add:
+    case ALU_OP::sub:
+    case ALU_OP::and_op:
+    case ALU_OP::xor_op:
+    case ALU_OP::or_op:
+    case ALU_OP::cp: add(Handler::alu8); break;
+    case ALU_OP::inc: add(Handler::inc); break;
+    case ALU_OP::dec: add(Handler::dec); break;
+    case ALU_OP::daa: add(Handler::daa); break;
+    case ALU_OP::cpl: add(Handler::cpl); break;
+    case ALU_OP::scf: add(Handler::scf); break;
+    case ALU_OP::ccf: add(Handler::ccf); break;
+    case ALU_OP::rl:
+    case ALU_OP::rr:
+    case ALU_OP::sla:
+    case ALU_OP::sra:
+    case ALU_OP::srl: add(Handler::shift); break;
+    case ALU_OP::swap: add(Handler::swap); break;
+    case ALU_OP::bit: add(Handler::bit); break;
+    case ALU_OP::res: add(Handler::res); break;
+    case ALU_OP::set: add(Handler::set); break;
+    case ALU_OP::sp_adjust: add(Handler::sp_adjust); break;
+    case ALU_OP::pc_adjust: add(Handler::pc_adjust); break;
+    case ALU_OP::pc_set: add(Handler::pc_set); break;
+    case ALU_OP::pc_reset: add(Handler::pc_reset); break;
+    case ALU_OP::inc16: add(Handler::inc16); break;
+    case ALU_OP::dec16: add(Handler::dec16); break;
+    case ALU_OP::add16: add(Handler::add16); break;
+    }
+
+    switch (ctrl.sys_op)
+    {
+    case SYS_OP::none: break;
+    case SYS_OP::ei: add(Handler::ei); break;
+    case SYS_OP::di: add(Handler::di); break;
+    case SYS_OP::halt: add(Handler::halt); break;
+    case SYS_OP::stop: add(Handler::stop); break;
+    }
+
+    add(Handler::end);
+    while (count < handlers.size()) handlers[count++] = Handler::end;
+    return handlers;
+}
+
 std::vector<Instructions::Instruction> Instructions::make_ops()
 {
     // When looking through the code here it can be helpful to think of each machine cycle (single ctrl value) as being the following stages in order.
@@ -1042,6 +1168,8 @@ std::vector<Instructions::Instruction> Instructions::make_ops()
                 // decode can't be conditional.
                 assert(!ctrl.decode && !ctrl.decode_cb);
                 break;
+            case CONDITION::none:
+                break;
             }
 
             // Decode can't occur until the end.
@@ -1222,3 +1350,61 @@ Instructions::Instruction Instructions::make_interrupt_op()
 
     return op;
 }
+
+
+const Instructions& Instructions::get()
+{
+    static const Instructions instr;
+    return instr;
+}
+
+std::array<HandlerList, 256> Instructions::handler_lists;
+
+Instructions::Instructions() :
+    num_handler_lists(0)
+{
+    const std::vector<Instruction> main_ops = make_ops();
+    const std::vector<Instruction> cb = make_cb_ops();
+    const Instruction irq = make_interrupt_op();
+
+    std::array<std::size_t, 256> main_idx;
+    std::array<std::size_t, 256> cb_idx;
+    std::size_t irq_idx;
+
+    // Lay everything out first so the entry pointers can't be invalidated by the table growing.
+    for (std::size_t i = 0; i < main_ops.size(); i++)
+    {
+        main_idx[i] = table.size();
+        for (const CPU_Control &ctrl : main_ops[i]) table.push_back(make_op(ctrl));
+    }
+    for (std::size_t i = 0; i < cb.size(); i++)
+    {
+        cb_idx[i] = table.size();
+        for (const CPU_Control &ctrl : cb[i]) table.push_back(make_op(ctrl));
+    }
+    irq_idx = table.size();
+    for (const CPU_Control &ctrl : irq) table.push_back(make_op(ctrl));
+    table.shrink_to_fit();
+
+    for (std::size_t i = 0; i < ops.size(); i++)
+    {
+        ops[i] = main_ops[i].empty() ? nullptr : &table[main_idx[i]];
+        cb_ops[i] = &table[cb_idx[i]];
+    }
+    interrupt_op = &table[irq_idx];
+}
+
+MicroOp Instructions::make_op(const CPU_Control &ctrl)
+{
+    HandlerList handlers = MicroOp::make_handlers(ctrl);
+
+    std::size_t index = 0;
+    while (index < num_handler_lists && handler_lists[index] != handlers) ++index;
+    if (index == num_handler_lists)
+    {
+        if (num_handler_lists == handler_lists.size()) throw std::logic_error("Too many micro-op handler lists");
+        handler_lists[num_handler_lists++] = handlers;
+    }
+
+    return MicroOp(ctrl, (std::uint8_t)index);
+}
@@ -18,25 +18,31 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef INSTRUCTIONS_HPP
 #define INSTRUCTIONS_HPP
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
+// The values of REG8 and REG16 double as indices into the CPU register file,
+// the plain 16-bit registers are stored as words with the 8-bit halves
+// overlaid little endian. So REG8 must equal 2 * REG16 (+ 1 for the high byte).
 enum class REG8
 {
     none,
+    F = 2,  // Flags
     A,      // Accumulator
-    F,      // Flags
-    B,      // General purpose
     C,      // General purpose
-    D,      // General purpose
+    B,      // General purpose
     E,      // General purpose
-    H,      // General purpose
+    D,      // General purpose
     L,      // General purpose
-    PCH,    // High word of program counter
-    PCL,    // Low word of program counter
-    SPH,    // High word of stack pointer
+    H,      // General purpose
     SPL,    // Low word of stack pointer
-    TH,     // High temp byte
+    SPH,    // High word of stack pointer
     TL,     // Low temp byte
+    TH,     // High temp byte
+    PCL,    // Low word of program counter
+    PCH,    // High word of program counter
 };
 
 enum class REG16
@@ -46,16 +52,24 @@ enum class REG16
     BC,     // Core
     DE,     // Core
     HL,     // Core
-    HLP,    // HL with increment
-    HLM,    // HL with decrement
-    PC,     // Core
     SP,     // Core
     T,      // Temp reg
+    PC,     // Core, but reading it increments it.
+    HLP,    // HL with increment
+    HLM,    // HL with decrement
     TP1,    // Temp + 1
     OTL,    // Offset with temp lo (0xFF00 + temp_lo)
     OC,     // Offset with C (0xFF00 + C)
 };
 
+// Registers in the order op codes number them, r8_map for the 3 bit fields
+// (none for (HL)) and r16_map for the 2 bit ones.
+static const REG8 r8_map[8] = {
+    REG8::B, REG8::C, REG8::D, REG8::E, REG8::H, REG8::L, REG8::none, REG8::A,
+};
+
+static const REG16 r16_map[4] = { REG16::BC, REG16::DE, REG16::HL, REG16::SP };
+
 enum class ALU_OP
 {
     none,
@@ -134,25 +148,128 @@ struct CPU_Control
     SYS_OP sys_op;
 };
 
+// Compact form of CPU_Control that the CPU executes from. Every field lives in
+// a fixed bit range of a single word so that the whole microcode table stays
+// small enough to sit in L1.
+class PackedControl
+{
+public:
+    explicit PackedControl(const CPU_Control &ctrl);
+
+    bool read() const { return field(0, 1) != 0; }
+    bool write() const { return field(1, 1) != 0; }
+    bool decode() const { return field(2, 1) != 0; }
+    bool decode_cb() const { return field(3, 1) != 0; }
+    bool ld() const { return field(4, 1) != 0; }
+    bool with_carry() const { return field(5, 1) != 0; }
+    bool ignore_zero() const { return field(6, 1) != 0; }
+
+    REG16 adr() const { return (REG16)field(8, 4); }
+    REG8 mem_reg() const { return (REG8)field(12, 4); }
+    REG8 src() const { return (REG8)field(16, 4); }
+    REG8 dst() const { return (REG8)field(20, 4); }
+    REG16 alu_r16() const { return (REG16)field(24, 4); }
+    REG8 alu_r8() const { return (REG8)field(28, 4); }
+
+    ALU_OP alu_op() const { return (ALU_OP)field(32, 5); }
+    CONDITION cond_op() const { return (CONDITION)field(40, 3); }
+    SYS_OP sys_op() const { return (SYS_OP)field(44, 3); }
+    std::uint8_t mask() const { return (std::uint8_t)field(48, 8); }
+
+protected:
+    // Bits 56 and up are left for MicroOp.
+    std::uint64_t bits;
+
+    std::uint32_t field(unsigned pos, unsigned width) const
+    {
+        return (std::uint32_t)(bits >> pos) & ((1u << width) - 1);
+    }
+};
+
+static_assert(sizeof(PackedControl) == 8, "PackedControl should be a single word.");
+
+// Handlers the CPU runs micro-ops with. They're listed through a macro so the
+// enum and the CPU's dispatch table can't get out of order.
+#define CPU_HANDLERS(X) \
+    /* Memory access of the current op, then moving on to the next op. */ \
+    X(next) X(read_next) X(read_sp_next) X(write_next) X(write_sp_next) \
+    X(fetch_decode) X(fetch_decode_cb) \
+    /* Stages of the new op. */ \
+    X(cond_nz) X(cond_z) X(cond_nc) X(cond_c) X(cond_always) X(cond_check) \
+    X(ld) \
+    X(alu8) X(inc) X(dec) X(daa) X(cpl) X(scf) X(ccf) X(shift) X(swap) \
+    X(bit) X(res) X(set) X(sp_adjust) X(pc_adjust) X(pc_set) X(pc_reset) \
+    X(inc16) X(dec16) X(add16) \
+    X(ei) X(di) X(halt) X(stop) \
+    X(end)
+
+enum class Handler : std::uint8_t
+{
+#define CPU_HANDLER_ENUM(name) name,
+    CPU_HANDLERS(CPU_HANDLER_ENUM)
+#undef CPU_HANDLER_ENUM
+};
+
+using HandlerList = std::array<Handler, 8>;
+
+// A micro-op together with its pre-decoded handlers. The first handler does
+// the memory access and moves on to the next op, while the stages of an op
+// start at the second and finish with Handler::end. Only the stages an op
+// actually uses get a handler. Micro-ops needing the same handlers share a
+// list in Instructions, picked by the top byte of the word, so a micro-op is
+// still a single word.
+class MicroOp : public PackedControl
+{
+public:
+    MicroOp(const CPU_Control &ctrl, std::uint8_t handler_list) :
+        PackedControl(ctrl)
+    {
+        bits |= (std::uint64_t)handler_list << 56;
+    }
+
+    std::uint8_t handler_list() const { return (std::uint8_t)field(56, 8); }
+
+    static HandlerList make_handlers(const CPU_Control &ctrl);
+};
+
+static_assert(sizeof(MicroOp) == 8, "MicroOp should be a single word.");
+
 class Instructions
 {
 public:
-    using Instruction = std::vector<CPU_Control>;
+    // All CPUs share a single table, built and checked the first time it is needed.
+    static const Instructions& get();
 
-    const std::vector<Instruction> ops;
-    const std::vector<Instruction> cb_ops;
-    const Instruction interrupt_op;
+    // Entry points into the table. Unimplemented op codes are nullptr.
+    std::array<const MicroOp*, 256> ops;
+    std::array<const MicroOp*, 256> cb_ops;
+    const MicroOp *interrupt_op;
 
-    Instructions() :
-        ops(make_ops()),
-        cb_ops(make_cb_ops()),
-        interrupt_op(make_interrupt_op())
-    {}
+    static const Handler* handlers(const MicroOp *op) { return handler_lists[op->handler_list()].data(); }
+
+    Instructions(const Instructions&) = delete;
+    Instructions& operator=(const Instructions&) = delete;
+
+    // The micro-ops of each instruction in the readable CPU_Control form the
+    // table is built from. Unimplemented op codes have none.
+    using Instruction = std::vector<CPU_Control>;
 
-private:
     static std::vector<Instruction> make_ops();
     static std::vector<Instruction> make_cb_ops();
     static Instruction make_interrupt_op();
+
+private:
+    Instructions();
+
+    // Every micro-op of every instruction, stored back to back.
+    std::vector<MicroOp> table;
+
+    // Every distinct list of handlers, only the first num_handler_lists are
+    // used. Static so that finding a list needs no pointer to the table.
+    static std::array<HandlerList, 256> handler_lists;
+    std::size_t num_handler_lists;
+
+    MicroOp make_op(const CPU_Control &ctrl);
 };
 
 #endif
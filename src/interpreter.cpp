@@ -0,0 +1,827 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Instruction granular version of the CPU. Each op code is run to completion
+// in one call. The scheduler sees exactly the machine cycles the microcode in
+// instructions.cpp would give it, which remains the reference for cycle
+// counts, but gets them in batches wherever that can't be observed.
+
+#include "cpu.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+#include "attention.hpp"
+#include "block_cache.hpp"
+#include "interrupt_controller.hpp"
+#include "jit.hpp"
+#include "mmu.hpp"
+#include "scheduler.hpp"
+
+static const REG16 r16_stack_map[4] = { REG16::BC, REG16::DE, REG16::HL, REG16::AF };
+
+static const ALU_OP alu_map[8] = {
+    ALU_OP::add, ALU_OP::add, ALU_OP::sub, ALU_OP::sub,
+    ALU_OP::and_op, ALU_OP::xor_op, ALU_OP::or_op, ALU_OP::cp,
+};
+
+static const ALU_OP shift_map[8] = {
+    ALU_OP::rl, ALU_OP::rr, ALU_OP::rl, ALU_OP::rr,
+    ALU_OP::sla, ALU_OP::sra, ALU_OP::swap, ALU_OP::srl,
+};
+
+void CPU::sync_clock()
+{
+    scheduler->advance(pending_cycles);
+    pending_cycles = 0;
+    event_horizon = scheduler->cycles_to_event();
+}
+
+std::uint64_t CPU::cycle_count() const
+{
+    return scheduler->now() + pending_cycles;
+}
+
+std::uint8_t CPU::read_cycle(std::uint16_t adr)
+{
+    tick();
+    if (is_io(adr))
+    {
+        sync_clock();
+        timed_read |= MMU::is_timed(adr);
+    }
+    return mmu->read_mem(adr);
+}
+
+void CPU::write_cycle(std::uint16_t adr, std::uint8_t val)
+{
+    tick();
+    if (is_io(adr))
+    {
+        sync_clock();
+        mmu->write_mem(adr, val);
+        // The write may have moved the next event.
+        event_horizon = scheduler->cycles_to_event();
+        return;
+    }
+    mmu->write_mem(adr, val);
+}
+
+template<>
+std::uint8_t CPU::imm8<false>()
+{
+    return read_cycle(next_pc());
+}
+
+template<>
+std::uint8_t CPU::imm8<true>()
+{
+    tick();
+    next_pc();
+    return *block_imm++;
+}
+
+std::uint8_t CPU::read_r8(int bits)
+{
+    if (bits == 6) return read_cycle(HL());
+    return getr8(r8_map[bits]);
+}
+
+void CPU::write_r8(int bits, std::uint8_t val)
+{
+    if (bits == 6) write_cycle(HL(), val);
+    else setr8(r8_map[bits], val);
+}
+
+bool CPU::check_cond(int bits)
+{
+    switch (bits)
+    {
+    case 0: return !(flags() & z_mask);
+    case 1: return !!(flags() & z_mask);
+    case 2: return !(flags() & c_mask);
+    default: return !!(flags() & c_mask);
+    }
+}
+
+void CPU::push16(std::uint16_t val)
+{
+    write_cycle(--SP(), (std::uint8_t)(val >> 8));
+    write_cycle(--SP(), (std::uint8_t)val);
+}
+
+std::uint16_t CPU::pop16()
+{
+    std::uint8_t lo = read_cycle(SP()++);
+    std::uint8_t hi = read_cycle(SP()++);
+    return make16(hi, lo);
+}
+
+void CPU::execute()
+{
+    execute_unsynced();
+    sync_clock();
+}
+
+void CPU::run_instructions()
+{
+    // The clock only has to be brought up to date once an event is due, so
+    // it's run on the same instruction as with execute(), and at the end.
+    do
+    {
+        execute_unsynced();
+        if (pending_cycles >= event_horizon) sync_clock();
+    } while (!(attention->get() & Attention::run_stop));
+    sync_clock();
+}
+
+void CPU::execute_unsynced()
+{
+    // Nothing runs in STOP mode, but time still passes. The timer is paused,
+    // so go straight to whatever event is next, such as the end of a run.
+    if ((attention->get() & Attention::stop) && isStopped())
+    {
+        if (pending_cycles < event_horizon && !(attention->get() & Attention::run_stop))
+        {
+            pending_cycles = std::min(event_horizon, pending_cycles + max_idle_skip);
+        }
+        sync_clock();
+        return;
+    }
+
+    // Same entry conditions as the first cycle of step(), but instructions never end mid way here.
+    tick();
+    if (pending_cycles >= event_horizon) sync_clock();
+
+    if ((attention->get() & Attention::cpu) && attend_instruction()) return;
+
+    std::uint16_t adr = next_pc();
+    if (is_io(adr)) sync_clock();
+    execute_op<false>(mmu->read_mem(adr));
+}
+
+bool CPU::attend_instruction()
+{
+    if (halting && !ic->interrupt_pending())
+    {
+        // Nothing changes until an event raises an interrupt, go straight to
+        // the next one.
+        if (pending_cycles < event_horizon && !(attention->get() & Attention::run_stop))
+        {
+            pending_cycles = std::min(event_horizon, pending_cycles + max_idle_skip);
+        }
+        sync_clock();
+        if (!ic->interrupt_pending()) return true;
+    }
+    set_halting(false);
+
+    if (ime && ic->interrupt_pending())
+    {
+        std::uint16_t vec = ic->accept_interrupt();
+        // The first cycle is the dummy cycle, see PUSH notes in instructions.cpp.
+        push16(PC());
+        PC() = vec;
+        ime = false;
+        sync_clock();
+        return true;
+    }
+    return false;
+}
+
+bool CPU::interrupt_due()
+{
+    // Includes an event that would be due on the next fetch cycle.
+    return ime && ((attention->get() & Attention::interrupt) || pending_cycles + 1 >= event_horizon);
+}
+
+Block* CPU::find_block()
+{
+    // Interrupts, halts and STOP are left to execute().
+    if ((attention->get() & (Attention::halt | Attention::stop)) || halt_bug || interrupt_due()) return nullptr;
+    return blocks->lookup(PC());
+}
+
+void CPU::run_block()
+{
+    const Block *block = find_block();
+    if (!block)
+    {
+        execute();
+        return;
+    }
+
+    if (block->idiom != Idiom::none) run_idiom(*block);
+    if (block->poll) run_poll(*block);
+    else if (block->aot) run_aot(*block);
+    else interpret_block(*block);
+}
+
+void CPU::run_jit()
+{
+    Block *block = find_block();
+    if (!block)
+    {
+        execute();
+        return;
+    }
+
+    if (block->idiom != Idiom::none) run_idiom(*block);
+    if (block->poll)
+    {
+        run_poll(*block);
+        return;
+    }
+
+    if (block->aot)
+    {
+        run_aot(*block);
+        return;
+    }
+
+    if (!block->native && ++block->runs == jit_threshold) block->native = jit->compile(*block);
+    if (!block->native)
+    {
+        interpret_block(*block);
+        return;
+    }
+
+    blocks->dirty = false;
+    block->native(this);
+    finish_native();
+}
+
+void CPU::run_idiom(const Block &block)
+{
+    // Runs all but the last pass of the loop at once, leaving the last one to
+    // the block so the loop exits the normal way. The final pass of the bulk
+    // part goes through the ALU to get A and the flags right, in case an
+    // interrupt comes before the block sets them again.
+    bool copy = true;
+    std::uint32_t passes;
+    std::uint32_t cycles;
+
+    switch (block.idiom)
+    {
+    case Idiom::copy_b:
+        passes = B() ? B() : 0x100;
+        cycles = 10;
+        break;
+    case Idiom::copy_c:
+        passes = C() ? C() : 0x100;
+        cycles = 10;
+        break;
+    case Idiom::copy_bc:
+        passes = r16(REG16::BC) ? r16(REG16::BC) : 0x10000;
+        cycles = 13;
+        break;
+    case Idiom::fill_b:
+        passes = B() ? B() : 0x100;
+        cycles = 6;
+        copy = false;
+        break;
+    case Idiom::fill_c:
+        passes = C() ? C() : 0x100;
+        cycles = 6;
+        copy = false;
+        break;
+    default:
+        return;
+    }
+    --passes;
+
+    // Stop short of the next event even with interrupts off, it may be the
+    // end of the run.
+    passes = std::min(passes, passes_to_horizon(cycles));
+    if (!passes) return;
+
+    if (copy)
+    {
+        if (!mmu->copy_mem(r16(REG16::DE), HL(), passes)) return;
+        r16(REG16::DE) += (std::uint16_t)passes;
+        A() = mmu->read_mem(HL() + (std::uint16_t)(passes - 1));
+    }
+    else
+    {
+        if (!mmu->fill_mem(HL(), A(), passes)) return;
+    }
+    HL() += (std::uint16_t)passes;
+
+    switch (block.idiom)
+    {
+    case Idiom::copy_b:
+    case Idiom::fill_b:
+        B() = dec8((std::uint8_t)(B() - passes + 1));
+        break;
+    case Idiom::copy_c:
+    case Idiom::fill_c:
+        C() = dec8((std::uint8_t)(C() - passes + 1));
+        break;
+    default:
+        r16(REG16::BC) -= (std::uint16_t)passes;
+        A() = B();
+        alu8(ALU_OP::or_op, false, C());
+        break;
+    }
+
+    pending_cycles += passes * cycles;
+}
+
+void CPU::run_poll(const Block &block)
+{
+    // Runs one pass, and if it left everything as it was without reading
+    // anything that changes with time, the loop can only end once an interrupt
+    // handler has run. The passes up to the next event can be skipped.
+    // Until then the clock only moves forward.
+    CPUState before = getState();
+    std::uint64_t start = cycle_count();
+    timed_read = false;
+
+    interpret_block(block);
+
+    CPUState after = getState();
+    if (timed_read || halting || interrupt_due() || cycle_count() == start ||
+        (attention->get() & Attention::run_stop) ||
+        after.A != before.A || after.F != before.F || after.B != before.B || after.C != before.C ||
+        after.D != before.D || after.E != before.E || after.H != before.H || after.L != before.L ||
+        after.PC != before.PC || after.SP != before.SP || after.ime != before.ime)
+    {
+        return;
+    }
+
+    // With nothing scheduled there's no next event, skip a while at a time.
+    std::uint32_t cycles = (std::uint32_t)(cycle_count() - start);
+    std::uint32_t passes = std::min(passes_to_horizon(cycles), max_idle_skip / cycles);
+    pending_cycles += passes * cycles;
+    sync_clock();
+}
+
+std::uint32_t CPU::passes_to_horizon(std::uint32_t cycles_per_pass) const
+{
+    if (event_horizon < pending_cycles + 2) return 0;
+    return (event_horizon - pending_cycles - 2) / cycles_per_pass;
+}
+
+void CPU::run_aot(const Block &block)
+{
+    blocks->dirty = false;
+    block.aot(&aot_ctx);
+    finish_native();
+}
+
+void CPU::finish_native()
+{
+    sync_clock();
+
+    if (jit_error)
+    {
+        std::exception_ptr error = jit_error;
+        jit_error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+bool CPU::jit_interrupt_due(CPU *cpu)
+{
+    return cpu->interrupt_due();
+}
+
+bool CPU::jit_run_op(CPU *cpu, const BlockOp *op)
+{
+    // Same as one pass of the loop in interpret_block().
+    try
+    {
+        cpu->tick();
+        cpu->next_pc();
+        cpu->block_imm = op->imm;
+        cpu->execute_op<true>(op->op_code);
+    }
+    catch (...)
+    {
+        cpu->jit_error = std::current_exception();
+        return true;
+    }
+    return cpu->blocks->dirty;
+}
+
+void CPU::interpret_block(const Block &block)
+{
+    blocks->dirty = false;
+
+    for (const BlockOp &op : block.ops)
+    {
+        if (interrupt_due()) break;
+
+        tick();
+        next_pc();
+        block_imm = op.imm;
+        execute_op<true>(op.op_code);
+
+        // Writes to ROM or to this block's own code end it early.
+        if (blocks->dirty) break;
+    }
+
+    sync_clock();
+}
+
+template<bool cached>
+void CPU::execute_op(std::uint8_t op_code)
+{
+    switch (op_code)
+    {
+    case 0x00:
+        // NOP
+        break;
+
+    case 0xcb:
+        execute_cb<cached>();
+        break;
+
+    case 0x06:
+    case 0x0e:
+    case 0x16:
+    case 0x1e:
+    case 0x26:
+    case 0x2e:
+    case 0x3e:
+        // LD R8, d8
+        write_r8(op_code >> 3, imm8<cached>());
+        break;
+
+    case 0x36:
+        // LD (HL), d8
+        write_r8(6, imm8<cached>());
+        break;
+
+    case 0x02:
+    case 0x0a:
+    case 0x12:
+    case 0x1a:
+    case 0x22:
+    case 0x2a:
+    case 0x32:
+    case 0x3a:
+        // LD (R16) <==> A
+        {
+            static const REG16 adr_map[4] = { REG16::BC, REG16::DE, REG16::HLP, REG16::HLM };
+            std::uint16_t adr = getr16(adr_map[op_code >> 4]);
+            if (op_code & 0x08) A() = read_cycle(adr);
+            else write_cycle(adr, A());
+        }
+        break;
+
+    case 0xea:
+    case 0xfa:
+        // LD (a16) <==> A
+        {
+            std::uint8_t lo = imm8<cached>();
+            std::uint16_t adr = make16(imm8<cached>(), lo);
+            if (op_code == 0xfa) A() = read_cycle(adr);
+            else write_cycle(adr, A());
+        }
+        break;
+
+    case 0xe0:
+    case 0xf0:
+        // LDH (a8) <=> A
+        {
+            std::uint16_t adr = 0xFF00 + imm8<cached>();
+            if (op_code == 0xf0) A() = read_cycle(adr);
+            else write_cycle(adr, A());
+        }
+        break;
+
+    case 0xe2:
+    case 0xf2:
+        // LD (C) <==> A
+        if (op_code == 0xf2) A() = read_cycle(0xFF00 + C());
+        else write_cycle(0xFF00 + C(), A());
+        break;
+
+    case 0x01:
+    case 0x11:
+    case 0x21:
+    case 0x31:
+        // LD R16, d16
+        {
+            std::uint8_t lo = imm8<cached>();
+            setr16(r16_map[op_code >> 4], make16(imm8<cached>(), lo));
+        }
+        break;
+
+    case 0xC1:
+    case 0xD1:
+    case 0xE1:
+    case 0xF1:
+        // POP R16
+        setr16(r16_stack_map[(op_code >> 4) & 3], pop16());
+        break;
+
+    case 0xC5:
+    case 0xD5:
+    case 0xE5:
+    case 0xF5:
+        // PUSH R16
+        idle_cycle();
+        push16(getr16(r16_stack_map[(op_code >> 4) & 3]));
+        break;
+
+    case 0x08:
+        // LD (a16), SP
+        {
+            std::uint8_t lo = imm8<cached>();
+            std::uint16_t adr = make16(imm8<cached>(), lo);
+            write_cycle(adr, (std::uint8_t)SP());
+            write_cycle(adr + 1, (std::uint8_t)(SP() >> 8));
+        }
+        break;
+
+    case 0xF8:
+        // LD HL, SP+r8
+        setr16(REG16::HL, add_sp(imm8<cached>()));
+        idle_cycle();
+        break;
+
+    case 0xF9:
+        // LD SP, HL
+        SP() = HL();
+        idle_cycle();
+        break;
+
+    case 0x04:
+    case 0x0c:
+    case 0x14:
+    case 0x1c:
+    case 0x24:
+    case 0x2c:
+    case 0x34:
+    case 0x3c:
+        // INC R8/(HL)
+        write_r8(op_code >> 3, inc8(read_r8(op_code >> 3)));
+        break;
+
+    case 0x05:
+    case 0x0d:
+    case 0x15:
+    case 0x1d:
+    case 0x25:
+    case 0x2d:
+    case 0x35:
+    case 0x3d:
+        // DEC R8/(HL)
+        write_r8(op_code >> 3, dec8(read_r8(op_code >> 3)));
+        break;
+
+    case 0x27:
+        // DAA
+        daa();
+        break;
+
+    case 0x2f:
+        // CPL
+        cpl();
+        break;
+
+    case 0x37:
+        // SCF
+        scf();
+        break;
+
+    case 0x3f:
+        // CCF
+        ccf();
+        break;
+
+    case 0x07:
+    case 0x0f:
+    case 0x17:
+    case 0x1f:
+        // R(R/L)[C]A
+        A() = shift8((op_code & 0x08) ? ALU_OP::rr : ALU_OP::rl, (op_code & 0x10) == 0, true, A());
+        break;
+
+    case 0x03:
+    case 0x13:
+    case 0x23:
+    case 0x33:
+        // INC R16
+        setr16(r16_map[op_code >> 4], getr16(r16_map[op_code >> 4]) + 1);
+        idle_cycle();
+        break;
+
+    case 0x0b:
+    case 0x1b:
+    case 0x2b:
+    case 0x3b:
+        // DEC R16
+        setr16(r16_map[op_code >> 4], getr16(r16_map[op_code >> 4]) - 1);
+        idle_cycle();
+        break;
+
+    case 0x09:
+    case 0x19:
+    case 0x29:
+    case 0x39:
+        // ADD HL, R16
+        add_hl(getr16(r16_map[op_code >> 4]));
+        idle_cycle();
+        break;
+
+    case 0xe8:
+        // ADD SP, r8
+        SP() = add_sp(imm8<cached>());
+        idle_cycle();
+        idle_cycle();
+        break;
+
+    case 0xc6:
+    case 0xce:
+    case 0xd6:
+    case 0xde:
+    case 0xe6:
+    case 0xee:
+    case 0xf6:
+    case 0xfe:
+        // ALU A, d8
+        {
+            int bits = (op_code >> 3) & 7;
+            alu8(alu_map[bits], bits == 1 || bits == 3, imm8<cached>());
+        }
+        break;
+
+    case 0xc7:
+    case 0xcf:
+    case 0xd7:
+    case 0xdf:
+    case 0xe7:
+    case 0xef:
+    case 0xf7:
+    case 0xff:
+        // RST
+        idle_cycle();
+        push16(PC());
+        PC() = op_code & 0x38;
+        break;
+
+    case 0x18:
+    case 0x20:
+    case 0x28:
+    case 0x30:
+    case 0x38:
+        // JR r8
+        {
+            bool cond = (op_code == 0x18) || check_cond((op_code >> 3) & 3);
+            std::uint16_t adjust = imm8<cached>();
+            if (!cond) break;
+            if (adjust & 0x80) adjust |= 0xFF00;
+            PC() += adjust;
+            idle_cycle();
+        }
+        break;
+
+    case 0xc2:
+    case 0xc3:
+    case 0xca:
+    case 0xd2:
+    case 0xda:
+        // JP a16
+        {
+            std::uint8_t lo = imm8<cached>();
+            bool cond = (op_code == 0xc3) || check_cond((op_code >> 3) & 3);
+            std::uint16_t adr = make16(imm8<cached>(), lo);
+            if (!cond) break;
+            PC() = adr;
+            idle_cycle();
+        }
+        break;
+
+    case 0xe9:
+        // JP HL
+        PC() = HL();
+        break;
+
+    case 0xc4:
+    case 0xcc:
+    case 0xcd:
+    case 0xd4:
+    case 0xdc:
+        // CALL a16
+        {
+            std::uint8_t lo = imm8<cached>();
+            bool cond = (op_code == 0xcd) || check_cond((op_code >> 3) & 3);
+            std::uint16_t adr = make16(imm8<cached>(), lo);
+            if (!cond) break;
+            push16(PC());
+            PC() = adr;
+            idle_cycle();
+        }
+        break;
+
+    case 0xc0:
+    case 0xc8:
+    case 0xd0:
+    case 0xd8:
+        // RET cc
+        if (!check_cond((op_code >> 3) & 3))
+        {
+            idle_cycle();
+            break;
+        }
+        idle_cycle();
+        // FALL-THROUGH
+    case 0xc9:
+    case 0xd9:
+        // RET/RETI
+        PC() = pop16();
+        idle_cycle();
+        if (op_code == 0xd9) ime = true;
+        break;
+
+    case 0x10:
+        // STOP
+        sync_clock();
+        stop();
+        event_horizon = scheduler->cycles_to_event();
+        break;
+
+    case 0x76:
+        // HALT
+        sync_clock();
+        if (!ime && ic->interrupt_pending()) halt_bug = true;
+        set_halting(!ic->interrupt_pending());
+        break;
+
+    case 0xf3:
+        // DI
+        ime = false;
+        break;
+
+    case 0xfb:
+        // EI
+        ime = true;
+        break;
+
+    default:
+        if (op_code >= 0x40 && op_code < 0x80)
+        {
+            // LD R8, R8 (and the (HL) forms)
+            write_r8((op_code >> 3) & 7, read_r8(op_code & 7));
+        }
+        else if (op_code >= 0x80 && op_code < 0xc0)
+        {
+            // ALU A, R8/(HL)
+            int bits = (op_code >> 3) & 7;
+            alu8(alu_map[bits], bits == 1 || bits == 3, read_r8(op_code & 7));
+        }
+        else
+        {
+            throw std::runtime_error("Unimplemented op code");
+        }
+        break;
+    }
+}
+
+template<bool cached>
+void CPU::execute_cb()
+{
+    std::uint8_t op_code = imm8<cached>();
+    int target = op_code & 7;
+    std::uint8_t val = read_r8(target);
+    std::uint8_t mask = 1 << ((op_code >> 3) & 7);
+
+    switch (op_code >> 6)
+    {
+    case 0:
+        {
+            ALU_OP op = shift_map[op_code >> 3];
+            if (op == ALU_OP::swap) val = swap8(val);
+            else val = shift8(op, op_code < 0x10, false, val);
+        }
+        break;
+    case 1:
+        bit8(mask, val);
+        return;
+    case 2:
+        val &= ~mask;
+        break;
+    case 3:
+        val |= mask;
+        break;
+    }
+
+    write_r8(target, val);
+}
@@ -20,31 +20,48 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <cstdint>
 
+#include "attention.hpp"
+
+class MMU;
+
 static const std::uint16_t IF_ADR = 0xff0f;
 static const std::uint16_t IE_ADR = 0xffff;
 
+// Keeps the interrupt flag in the attention word up to date with IE & IF.
 class InterruptController
 {
 public:
+    InterruptController(Attention *attention) :
+        attention(attention)
+    {}
+
+    // Puts IF in the MMU's I/O table. IE is outside it, at the very end.
+    void map_io(MMU &mmu);
+
     bool interrupt_pending() const { return !!(IE & IF); }
+    bool joypad_requested() const { return !!(IF & 0x10); }
     std::uint8_t accept_interrupt();
 
-    void setIF(std::uint8_t val) { IF = val & ~unused; }
-    void setIE(std::uint8_t val) { IE = val & ~unused; }
+    void setIF(std::uint8_t val) { IF = val & ~unused; update(); }
+    void setIE(std::uint8_t val) { IE = val & ~unused; update(); }
     std::uint8_t getIF() const { return IF | unused; }
     std::uint8_t getIE() const { return IE; }
 
-    void signal_v_blank_irq() { IF |= 0x01; }
-    void signal_lcd_stat_irq() { IF |= 0x02; }
-    void signal_timer_irq() { IF |= 0x04; }
-    void signal_serial_irq() { IF |= 0x08; }
-    void signal_joypad_irq() { IF |= 0x10; }
+    void signal_v_blank_irq() { IF |= 0x01; update(); }
+    void signal_lcd_stat_irq() { IF |= 0x02; update(); }
+    void signal_timer_irq() { IF |= 0x04; update(); }
+    void signal_serial_irq() { IF |= 0x08; update(); }
+    void signal_joypad_irq() { IF |= 0x10; update(); }
 
 private:
     static const std::uint8_t unused = 0xe0;
 
     std::uint8_t IE = 0;
     std::uint8_t IF = 0;
+
+    Attention *attention;
+
+    void update() { attention->assign(Attention::interrupt, interrupt_pending()); }
 };
 
 #endif
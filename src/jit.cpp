@@ -0,0 +1,310 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "jit.hpp"
+
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#include "cpu.hpp"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+// Collects x86-64 machine code. Every memory operand is [rbx + disp32], with
+// rbx holding the CPU for the whole block.
+class Emitter
+{
+public:
+    std::vector<std::uint8_t> code;
+
+    void bytes(std::initializer_list<unsigned> list)
+    {
+        for (unsigned b : list) code.push_back((std::uint8_t)b);
+    }
+
+    void imm(std::uint64_t val, int size)
+    {
+        for (int i = 0; i < size; ++i) code.push_back((std::uint8_t)(val >> (8 * i)));
+    }
+
+    void mem(std::initializer_list<unsigned> op, unsigned reg, std::int32_t disp)
+    {
+        bytes(op);
+        bytes({ 0x80 | reg << 3 | 3 });
+        imm((std::uint32_t)disp, 4);
+    }
+
+    // mov rdi, rbx ; mov rax, fn ; call rax ; test al, al ; jne exit
+    void call_check(const void *fn, std::vector<std::size_t> &exits)
+    {
+        bytes({ 0x48, 0x89, 0xDF });
+        bytes({ 0x48, 0xB8 });
+        imm((std::uintptr_t)fn, 8);
+        bytes({ 0xFF, 0xD0, 0x84, 0xC0, 0x0F, 0x85 });
+        exits.push_back(code.size());
+        imm(0, 4);
+    }
+};
+
+static const std::size_t call_check_size = 23;
+
+JIT::JIT(CPU *cpu, BlockCache *blocks) :
+    cpu(cpu), blocks(blocks), buffer(nullptr), used(0)
+{
+#ifdef JIT_SUPPORTED
+    void *mem = mmap(nullptr, buffer_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) buffer = static_cast<std::uint8_t*>(mem);
+#endif
+}
+
+JIT::~JIT()
+{
+#ifdef JIT_SUPPORTED
+    if (buffer) munmap(buffer, buffer_size);
+#endif
+}
+
+std::int32_t JIT::offset(const void *field) const
+{
+    return (std::int32_t)(static_cast<const char*>(field) - reinterpret_cast<const char*>(cpu));
+}
+
+void JIT::emit_step(Emitter &e, std::uint8_t cycles, std::uint16_t pc_delta)
+{
+    // add dword [pending_cycles], cycles ; add word [PC], pc_delta
+    e.mem({ 0x83 }, 0, offset(&cpu->pending_cycles));
+    e.imm(cycles, 1);
+    if (!pc_delta) return;
+    e.mem({ 0x66, 0x81 }, 0, offset(&cpu->PC()));
+    e.imm(pc_delta, 2);
+}
+
+void JIT::emit_alu(Emitter &e, int bits, const BlockOp &op)
+{
+    // Same results and lazy flags as CPU::alu8() for everything but ADC/SBC.
+    bool from_imm = op.op_code >= 0xc0;
+    std::int32_t a = offset(&cpu->A());
+    std::int32_t src = from_imm ? 0 : offset(&cpu->r8(r8_map[op.op_code & 7]));
+
+    if (bits >= 4 && bits <= 6)
+    {
+        static const unsigned op_mem[3] = { 0x22, 0x32, 0x0A };
+        static const unsigned op_imm[3] = { 0x24, 0x34, 0x0C };
+
+        e.mem({ 0x8A }, 0, a);
+        if (from_imm) e.bytes({ op_imm[bits - 4], op.imm[0] });
+        else e.mem({ op_mem[bits - 4] }, 0, src);
+        e.mem({ 0x88 }, 0, a);
+
+        e.mem({ 0xC6 }, 0, offset(&cpu->flag_op));
+        e.imm((std::uint8_t)CPU::FlagOp::logic, 1);
+        e.mem({ 0xC6 }, 0, offset(&cpu->flag_b));
+        e.imm(bits == 4 ? CPU::h_mask : 0, 1);
+        e.bytes({ 0x0F, 0xB6, 0xC0 });
+        e.mem({ 0x66, 0x89 }, 0, offset(&cpu->flag_result));
+        return;
+    }
+
+    bool subtract = bits != 0;
+
+    e.mem({ 0x0F, 0xB6 }, 0, a);
+    if (from_imm)
+    {
+        e.bytes({ 0xB9 });
+        e.imm(op.imm[0], 4);
+    }
+    else
+    {
+        e.mem({ 0x0F, 0xB6 }, 1, src);
+    }
+    if (subtract) e.bytes({ 0x81, 0xF1, 0xFF, 0x00, 0x00, 0x00 });
+
+    e.mem({ 0x88 }, 0, offset(&cpu->flag_a));
+    e.mem({ 0x88 }, 1, offset(&cpu->flag_b));
+    // lea edx, [rax + rcx (+ 1)], the plus one being the inverted borrow.
+    if (subtract) e.bytes({ 0x8D, 0x54, 0x08, 0x01 });
+    else e.bytes({ 0x8D, 0x14, 0x08 });
+    e.mem({ 0x66, 0x89 }, 2, offset(&cpu->flag_result));
+    e.mem({ 0xC6 }, 0, offset(&cpu->flag_op));
+    e.imm((std::uint8_t)(subtract ? CPU::FlagOp::sub : CPU::FlagOp::add), 1);
+    if (bits != 7) e.mem({ 0x88 }, 2, a);
+}
+
+bool JIT::emit_native(Emitter &e, const BlockOp &op)
+{
+    std::uint8_t op_code = op.op_code;
+    std::uint16_t imm16 = (std::uint16_t)(op.imm[0] | op.imm[1] << 8);
+
+    if (op_code == 0x00)
+    {
+        // NOP
+        emit_step(e, 1, 1);
+        return true;
+    }
+
+    if (op_code == 0xf3 || op_code == 0xfb)
+    {
+        // DI/EI
+        e.mem({ 0xC6 }, 0, offset(&cpu->ime));
+        e.imm(op_code == 0xfb, 1);
+        emit_step(e, 1, 1);
+        return true;
+    }
+
+    if (op_code >= 0x40 && op_code < 0x80 && (op_code & 7) != 6 && ((op_code >> 3) & 7) != 6)
+    {
+        // LD R8, R8
+        e.mem({ 0x8A }, 0, offset(&cpu->r8(r8_map[op_code & 7])));
+        e.mem({ 0x88 }, 0, offset(&cpu->r8(r8_map[(op_code >> 3) & 7])));
+        emit_step(e, 1, 1);
+        return true;
+    }
+
+    if ((op_code & 0xC7) == 0x06 && op_code != 0x36)
+    {
+        // LD R8, d8
+        e.mem({ 0xC6 }, 0, offset(&cpu->r8(r8_map[op_code >> 3])));
+        e.imm(op.imm[0], 1);
+        emit_step(e, 2, 2);
+        return true;
+    }
+
+    if ((op_code & 0xCF) == 0x01)
+    {
+        // LD R16, d16
+        e.mem({ 0x66, 0xC7 }, 0, offset(&cpu->r16(r16_map[op_code >> 4])));
+        e.imm(imm16, 2);
+        emit_step(e, 3, 3);
+        return true;
+    }
+
+    if ((op_code & 0xC7) == 0x03)
+    {
+        // INC/DEC R16
+        e.mem({ 0x66, 0xFF }, (op_code & 0x08) ? 1 : 0, offset(&cpu->r16(r16_map[op_code >> 4])));
+        emit_step(e, 2, 1);
+        return true;
+    }
+
+    int bits = (op_code >> 3) & 7;
+    bool with_carry = bits == 1 || bits == 3;
+
+    if (op_code >= 0x80 && op_code < 0xc0 && (op_code & 7) != 6 && !with_carry)
+    {
+        // ALU A, R8
+        emit_alu(e, bits, op);
+        emit_step(e, 1, 1);
+        return true;
+    }
+
+    if ((op_code & 0xC7) == 0xC6 && !with_carry)
+    {
+        // ALU A, d8
+        emit_alu(e, bits, op);
+        emit_step(e, 2, 2);
+        return true;
+    }
+
+    if (op_code == 0xc3)
+    {
+        // JP a16
+        e.mem({ 0x66, 0xC7 }, 0, offset(&cpu->PC()));
+        e.imm(imm16, 2);
+        emit_step(e, 4, 0);
+        return true;
+    }
+
+    if (op_code == 0x18)
+    {
+        // JR r8
+        emit_step(e, 3, (std::uint16_t)(2 + (std::int8_t)op.imm[0]));
+        return true;
+    }
+
+    return false;
+}
+
+JIT::Code JIT::compile(const Block &block)
+{
+#ifdef JIT_SUPPORTED
+    if (!buffer) return nullptr;
+
+    Emitter e;
+    std::vector<std::size_t> exits;
+
+    // push rbx ; mov rbx, rdi
+    e.bytes({ 0x53, 0x48, 0x89, 0xFB });
+
+    for (const BlockOp &op : block.ops)
+    {
+        // if (ime && interrupt_due()) return;
+        e.mem({ 0x80 }, 7, offset(&cpu->ime));
+        e.bytes({ 0x00, 0x74, call_check_size });
+        e.call_check(reinterpret_cast<const void*>(&CPU::jit_interrupt_due), exits);
+
+        if (emit_native(e, op)) continue;
+
+        // if (jit_run_op(op)) return;
+        e.bytes({ 0x48, 0xBE });
+        e.imm((std::uintptr_t)&op, 8);
+        e.call_check(reinterpret_cast<const void*>(&CPU::jit_run_op), exits);
+    }
+
+    for (std::size_t pos : exits)
+    {
+        std::int32_t rel = (std::int32_t)(e.code.size() - (pos + 4));
+        std::memcpy(&e.code[pos], &rel, 4);
+    }
+
+    // pop rbx ; ret
+    e.bytes({ 0x5B, 0xC3 });
+
+    return install(e.code.data(), e.code.size());
+#else
+    (void)block;
+    return nullptr;
+#endif
+}
+
+JIT::Code JIT::install(const std::uint8_t *code, std::size_t size)
+{
+#ifdef JIT_SUPPORTED
+    if (size > buffer_size) return nullptr;
+    if (used + size > buffer_size)
+    {
+        blocks->drop_native();
+        used = 0;
+    }
+
+    // Never writable and executable at the same time.
+    if (mprotect(buffer, buffer_size, PROT_READ | PROT_WRITE) != 0) return nullptr;
+    std::memcpy(buffer + used, code, size);
+    if (mprotect(buffer, buffer_size, PROT_READ | PROT_EXEC) != 0) return nullptr;
+
+    Code fn = reinterpret_cast<Code>(buffer + used);
+    used += size;
+    return fn;
+#else
+    (void)code;
+    (void)size;
+    return nullptr;
+#endif
+}
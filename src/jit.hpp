@@ -0,0 +1,66 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "block_cache.hpp"
+
+class CPU;
+class Emitter;
+
+// Translates hot blocks to x86-64 code. Only available on x86-64 Linux,
+// elsewhere compile() always fails and blocks keep being interpreted.
+//
+// Simple register only ops are translated directly, anything else calls back
+// into the instruction engine for that one op. Compiled code keeps the same
+// cycle count and stops at the same points as CPU::run_block().
+class JIT
+{
+public:
+    typedef void (*Code)(CPU *cpu);
+
+    JIT(CPU *cpu, BlockCache *blocks);
+    ~JIT();
+
+    JIT(const JIT&) = delete;
+    JIT& operator=(const JIT&) = delete;
+
+    // Native code for the block, or nullptr if it can't be compiled. Once the
+    // code buffer fills up it starts over, dropping every block's code.
+    Code compile(const Block &block);
+
+private:
+    static const std::size_t buffer_size = 4 << 20;
+
+    CPU *cpu;
+    BlockCache *blocks;
+
+    std::uint8_t *buffer;
+    std::size_t used;
+
+    std::int32_t offset(const void *field) const;
+    void emit_step(Emitter &e, std::uint8_t cycles, std::uint16_t pc_delta);
+    void emit_alu(Emitter &e, int bits, const BlockOp &op);
+    bool emit_native(Emitter &e, const BlockOp &op);
+    Code install(const std::uint8_t *code, std::size_t size);
+};
+
+#endif
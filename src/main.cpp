@@ -20,9 +20,19 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <iomanip>
 #include <iostream>
 #include <stdexcept>
+#include <string>
 
 #include "system.hpp"
 
+// The rest of the line, if anything, as a condition. Throws if it isn't one.
+static Condition readCondition()
+{
+    std::string text;
+    std::getline(std::cin, text);
+    std::size_t start = text.find_first_not_of(" \t");
+    return start == std::string::npos ? Condition() : Condition(text.substr(start));
+}
+
 int main(int argc, char **argv)
 {
     try
@@ -35,6 +45,7 @@ int main(int argc, char **argv)
         System sys;
         sys.cart.loadCart(rom_file);
         rom_file.close();
+        sys.reset();
 
         CartHeader header = sys.cart.getHeader();
         std::cout << "Loaded " << header.title <<
@@ -50,6 +61,11 @@ int main(int argc, char **argv)
             " Global: " << header.global_checksum << std::hex << std::setw(4) << header.global_checksum <<
             (header.global_checksum_passed ? "" : " (BAD)") << '\n';
 
+        std::string rom_path = argv[1];
+        std::size_t slash = rom_path.find_last_of("/\\");
+        std::string rom_dir = slash == std::string::npos ? "." : rom_path.substr(0, slash);
+        if (sys.loadAOT(rom_dir)) std::cout << "Using recompiled code from " << AOTLibrary::fileName(header.global_checksum) << '\n';
+
         if (!header.dmg_compat) std::cout << "WARN: ROM appears to be incomaptible with DMG.\n";
         if (!header.logo_check_passed) std::cout << "WARN: Logo data in header appears to be corrupt.\n";
 
@@ -83,22 +99,111 @@ int main(int argc, char **argv)
                 sys.reset();
                 break;
             case 'c':
-                sys.run();
+                if (sys.run() == StopReason::watchpoint)
+                {
+                    for (const WatchpointHit &hit : sys.mmu.getWatchHits())
+                    {
+                        std::cout << (hit.write ? "Write " : "Read ") <<
+                            std::setfill('0') << std::setw(4) << std::hex << hit.adr << ": " <<
+                            std::setw(2) << (int)hit.old_val << " -> " << std::setw(2) << (int)hit.new_val <<
+                            " PC: " << std::setw(4) << hit.PC << '\n';
+                    }
+                    sys.mmu.clear_watch_hits();
+                }
                 break;
             case 'b':
                 {
-                    int idx;
+                    // b + <adr> [cond] adds a breakpoint, b - <adr> removes
+                    // one, b c clears them all and b l lists them.
+                    char op;
+                    std::cin >> op;
+                    if (op == 'l')
+                    {
+                        for (std::uint16_t adr : sys.breakpoints.list())
+                        {
+                            std::cout << std::setfill('0') << std::setw(4) << std::hex << adr;
+                            const Condition &cond = sys.breakpoints.getCondition(adr);
+                            if (!cond.empty()) std::cout << " if " << cond.getText();
+                            std::cout << '\n';
+                        }
+                        break;
+                    }
+                    if (op == 'c')
+                    {
+                        sys.breakpoints.clear();
+                        break;
+                    }
+
                     int adr;
-                    std::cin >> idx >> std::hex >> adr;
-                    sys.breakpoints[idx] = adr;
+                    std::cin >> std::hex >> adr;
+                    if (op == '+')
+                    {
+                        try
+                        {
+                            sys.breakpoints.add((std::uint16_t)adr, readCondition());
+                        }
+                        catch (std::runtime_error &e)
+                        {
+                            std::cout << e.what() << '\n';
+                        }
+                    }
+                    else if (op == '-') sys.breakpoints.remove((std::uint16_t)adr);
                 }
                 break;
             case 'm':
                 {
-                    int idx;
-                    int adr;
-                    std::cin >> idx >> std::hex >> adr;
-                    sys.mmu.breakpoints[idx] = adr;
+                    // m r|w|a <first> <last> [cond] watches reads, writes or
+                    // both, m v <first> <last> <val> [cond] watches writes of
+                    // one value, m - <idx> removes one, m c clears them all
+                    // and m l lists them.
+                    char op;
+                    std::cin >> op;
+                    if (op == 'l')
+                    {
+                        std::size_t idx = 0;
+                        for (const Watchpoint &wp : sys.mmu.getWatchpoints())
+                        {
+                            std::cout << std::dec << idx++ << ": " << (wp.on_read ? "r" : "") << (wp.on_write ? "w" : "") << ' ' <<
+                                std::setfill('0') << std::setw(4) << std::hex << wp.first << '-' << std::setw(4) << wp.last;
+                            if (wp.value >= 0) std::cout << " = " << std::setw(2) << wp.value;
+                            if (!wp.condition.empty()) std::cout << " if " << wp.condition.getText();
+                            std::cout << '\n';
+                        }
+                        break;
+                    }
+                    if (op == 'c')
+                    {
+                        sys.mmu.clear_watchpoints();
+                        break;
+                    }
+                    if (op == '-')
+                    {
+                        std::size_t idx;
+                        std::cin >> std::dec >> idx;
+                        if (idx < sys.mmu.getWatchpoints().size()) sys.mmu.remove_watchpoint(idx);
+                        break;
+                    }
+
+                    int first;
+                    int last;
+                    int val = -1;
+                    std::cin >> std::hex >> first >> last;
+                    if (op == 'v') std::cin >> val;
+                    Watchpoint wp;
+                    wp.first = (std::uint16_t)first;
+                    wp.last = (std::uint16_t)last;
+                    wp.on_read = op == 'r' || op == 'a';
+                    wp.on_write = op != 'r';
+                    wp.value = (std::int16_t)val;
+                    try
+                    {
+                        wp.condition = readCondition();
+                        sys.mmu.add_watchpoint(wp);
+                    }
+                    catch (std::runtime_error &e)
+                    {
+                        std::cout << e.what() << '\n';
+                    }
                 }
                 break;
             case 'd':
@@ -109,7 +214,7 @@ int main(int argc, char **argv)
 
                     for (std::uint16_t i = 0; i < count; i++)
                     {
-                        std::cout << std::setw(2) << std::hex << (int)sys.mmu.read_mem((std::uint16_t)adr + i) << ' ';
+                        std::cout << std::setw(2) << std::hex << (int)sys.mmu.peek_mem((std::uint16_t)adr + i) << ' ';
                     }
                     std::cout << std::endl;
                 }
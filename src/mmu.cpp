@@ -20,12 +20,86 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <cassert>
 #include <iostream>
 
+#include "attention.hpp"
+#include "block_cache.hpp"
 #include "cart.hpp"
+#include "cpu.hpp"
 #include "gpu.hpp"
 #include "interrupt_controller.hpp"
 #include "timer.hpp"
 
-std::uint8_t MMU::read_mem(std::uint16_t adr)
+MMU::MMU(Cart *cart,
+    GPU *gpu,
+    InterruptController *ic,
+    BlockCache *blocks,
+    Attention *attention,
+    CPU *cpu) :
+    cart(cart), gpu(gpu), ic(ic), blocks(blocks), attention(attention), cpu(cpu),
+    checked_hits(0)
+{
+    base_read.fill(nullptr);
+    base_write.fill(nullptr);
+    read_map.fill(nullptr);
+    write_map.fill(nullptr);
+    ioshadow.fill(0);
+
+    for (std::uint16_t adr = 0xff00; adr < 0xff80; ++adr)
+    {
+        std::uint8_t &reg = ioshadow[adr - 0xff00];
+        set_io(adr, [&reg]() { return reg; }, [&reg](std::uint8_t val) { reg = val; });
+    }
+
+    // There's no serial port yet, but test ROMs print through it.
+    std::uint8_t &SB = ioshadow[0x01];
+    set_io(0xff01, [&SB]() { return SB; }, [&SB](std::uint8_t val) { std::cout << (char)val; SB = val; });
+}
+
+void MMU::set_io(std::uint16_t adr, IORead read, IOWrite write, std::uint8_t unused)
+{
+    assert(adr >= 0xff00 && adr < 0xff80);
+    IOPort &port = io_ports[adr - 0xff00];
+    port.read = read;
+    port.write = write;
+    port.unused = unused;
+}
+
+std::uint8_t MMU::watched_read(std::uint16_t adr)
+{
+    std::uint8_t val = peek_mem(adr);
+    check_watchpoints(adr, val, val, false);
+    return val;
+}
+
+std::uint8_t MMU::read_slow(std::uint16_t adr)
+{
+    if (read_pages[adr >> 8]) return watched_read(adr);
+    return read_handler(adr);
+}
+
+void MMU::write_slow(std::uint16_t adr, std::uint8_t val)
+{
+    if (write_pages[adr >> 8]) check_watchpoints(adr, peek_mem(adr), val, true);
+
+    std::uint8_t *page = base_write[adr >> 8];
+    if (!page)
+    {
+        write_handler(adr, val);
+        return;
+    }
+
+    // Plain memory that's left out of the table for cached code.
+    if (adr >= 0xc000 && adr < 0xfe00) blocks->notify_ram_write(adr < 0xe000 ? adr : adr - 0x2000);
+    page[adr & 0xff] = val;
+}
+
+std::uint8_t MMU::peek_mem(std::uint16_t adr)
+{
+    const std::uint8_t *page = base_read[adr >> 8];
+    if (page) return page[adr & 0xff];
+    return read_handler(adr);
+}
+
+std::uint8_t MMU::read_handler(std::uint16_t adr)
 {
     if (adr < 0x8000) return cart->readROM(adr);
     if (adr < 0xa000) return gpu->readVRAM(adr - 0x8000);
@@ -33,65 +107,257 @@ std::uint8_t MMU::read_mem(std::uint16_t adr)
     if (adr < 0xe000) return loram.at(adr - 0xc000);
     if (adr < 0xfe00) return loram.at(adr - 0xe000);
     if (adr < 0xfea0) return gpu->readOAM(adr - 0xfe00);
-    if (adr < 0xff00) { assert(false); return 0; }
+    // Nothing answers in the unusable area.
+    if (adr < 0xff00) return 0;
     if (adr < 0xff80)
     {
-        switch (adr)
-        {
-        case IF_ADR:
-            return ic->getIF();
-        case DIV_ADR:
-            return timer->getDIV();
-        case TIMA_ADR:
-            return timer->getTIMA();
-        case TMA_ADR:
-            return timer->getTMA();
-        case TAC_ADR:
-            return timer->getTAC();
-        default:
-            return ioshadow.at(adr - 0xff00);
-        }
+        const IOPort &port = io_ports[adr - 0xff00];
+        return port.read() | port.unused;
     }
     if (adr < 0xffff) return hiram.at(adr - 0xff80);
     return ic->getIE();
 }
 
-void MMU::write_mem(std::uint16_t adr, std::uint8_t val)
+void MMU::write_handler(std::uint16_t adr, std::uint8_t val)
 {
-    for (std::int32_t bp : breakpoints) break_req |= bp == adr;
-
-    if (adr < 0x8000) { cart->writeROM(adr, val); return; }
+    if (adr < 0x8000)
+    {
+        cart->writeROM(adr, val);
+        // Most writes switch one bank or none, so only remap what moved.
+        // Each window is one bank, so its first page shows whether it did.
+        if (cart->mapROM(0x4000, 0x100) != base_read[0x40])
+        {
+            blocks->notify_rom_write();
+            map_rom_bank();
+        }
+        if (cart->mapRAM(0x0000, 0x100) != base_write[0xa0]) map_ram_bank();
+        return;
+    }
     if (adr < 0xa000) { gpu->writeVRAM(adr - 0x8000, val); return; }
     if (adr < 0xc000) { cart->writeRAM(adr - 0xa000, val); return; }
-    if (adr < 0xe000) { loram.at(adr - 0xc000) = val; return; }
-    if (adr < 0xfe00) { loram.at(adr - 0xe000) = val; return; }
+    if (adr < 0xe000) { blocks->notify_ram_write(adr); loram.at(adr - 0xc000) = val; return; }
+    if (adr < 0xfe00) { blocks->notify_ram_write(adr - 0x2000); loram.at(adr - 0xe000) = val; return; }
     if (adr < 0xfea0) { gpu->writeOAM(adr - 0xfe00, val); return; }
-    if (adr < 0xff00) { assert(false); return; }
-    if (adr < 0xff80)
+    if (adr < 0xff00) return;
+    if (adr < 0xff80) { io_ports[adr - 0xff00].write(val); return; }
+    if (adr < 0xffff) { blocks->notify_ram_write(adr); hiram.at(adr - 0xff80) = val; return; }
+    ic->setIE(val);
+}
+
+void MMU::reset()
+{
+    // OAM, I/O and HRAM always go through the handlers, they share pages
+    // with things that aren't memory. VRAM will need to come and go once
+    // the PPU locks it.
+    base_read.fill(nullptr);
+    base_write.fill(nullptr);
+    for (std::uint32_t page = 0x80; page < 0xa0; ++page)
+    {
+        base_write[page] = gpu->mapVRAM((std::uint16_t)((page - 0x80) << 8));
+        base_read[page] = base_write[page];
+    }
+    for (std::uint32_t page = 0xc0; page < 0xfe; ++page)
+    {
+        base_write[page] = loram.data() + (((page - 0xc0) & 0x1f) << 8);
+        base_read[page] = base_write[page];
+    }
+
+    code_pages.reset();
+    clear_watch_hits();
+    map_cart();
+    map_all();
+}
+
+void MMU::map_cart()
+{
+    for (std::uint32_t page = 0; page < 0x40; ++page)
+    {
+        base_read[page] = cart->mapROM((std::uint16_t)(page << 8), 0x100);
+        map_page(page);
+    }
+    map_rom_bank();
+    map_ram_bank();
+}
+
+void MMU::map_rom_bank()
+{
+    for (std::uint32_t page = 0x40; page < 0x80; ++page)
+    {
+        base_read[page] = cart->mapROM((std::uint16_t)(page << 8), 0x100);
+        map_page(page);
+    }
+}
+
+void MMU::map_ram_bank()
+{
+    for (std::uint32_t page = 0xa0; page < 0xc0; ++page)
+    {
+        base_write[page] = cart->mapRAM((std::uint16_t)((page - 0xa0) << 8), 0x100);
+        base_read[page] = base_write[page];
+        map_page(page);
+    }
+}
+
+void MMU::protect_code(std::uint16_t first, std::uint16_t last)
+{
+    for (std::uint32_t page = first >> 8; page <= (std::uint32_t)(last >> 8); ++page)
     {
-        switch (adr)
+        code_pages.set(page);
+        map_page(page);
+        // Along with the echo of WRAM.
+        if (page >= 0xc0 && page < 0xde)
         {
-        case IF_ADR:
-            ic->setIF(val);
-            return;
-        case DIV_ADR:
-            timer->setDIV(val);
-            return;
-        case TIMA_ADR:
-            timer->setTIMA(val);
-            return;
-        case TMA_ADR:
-            timer->setTMA(val);
-            return;
-        case TAC_ADR:
-            timer->setTAC(val);
-            return;
-        default:
-            if (adr == 0xff01) std::cout << (char)val;
-            ioshadow.at(adr - 0xff00) = val;
-            return;
+            code_pages.set(page + 0x20);
+            map_page(page + 0x20);
         }
     }
-    if (adr < 0xffff) { hiram.at(adr - 0xff80) = val; return; }
-    ic->setIE(val);
+}
+
+void MMU::unprotect_code()
+{
+    code_pages.reset();
+    map_all();
+}
+
+void MMU::map_page(std::uint32_t page)
+{
+    read_map[page] = read_pages[page] ? nullptr : base_read[page];
+    write_map[page] = (write_pages[page] || code_pages[page]) ? nullptr : base_write[page];
+}
+
+void MMU::map_all()
+{
+    for (std::uint32_t page = 0; page < 0x100; ++page) map_page(page);
+}
+
+bool MMU::is_timed(std::uint16_t adr)
+{
+    return adr == DIV_ADR || adr == TIMA_ADR || adr == IF_ADR;
+}
+
+const std::uint8_t* MMU::plain_read(std::uint16_t adr, std::uint32_t len)
+{
+    if (adr < 0x8000) return cart->mapROM(adr, len);
+    return plain_write(adr, len);
+}
+
+std::uint8_t* MMU::plain_write(std::uint16_t adr, std::uint32_t len)
+{
+    std::uint32_t end = adr + len;
+    if (adr >= 0x8000 && end <= 0xa000) return gpu->mapVRAM(adr - 0x8000);
+    if (adr >= 0xc000 && end <= 0xe000) return loram.data() + (adr - 0xc000);
+    if (adr >= 0xff80 && end <= 0xff80 + hiram.size()) return hiram.data() + (adr - 0xff80);
+    return nullptr;
+}
+
+void MMU::notify_bulk_write(std::uint16_t dst, std::uint32_t len)
+{
+    if (dst < 0xc000) return;
+    for (std::uint32_t i = 0; i < len; ++i) blocks->notify_ram_write((std::uint16_t)(dst + i));
+}
+
+bool MMU::copy_mem(std::uint16_t dst, std::uint16_t src, std::uint32_t len)
+{
+    if (watched(write_pages, dst, len) || watched(read_pages, src, len)) return false;
+
+    const std::uint8_t *from = plain_read(src, len);
+    std::uint8_t *to = plain_write(dst, len);
+    if (!from || !to) return false;
+
+    for (std::uint32_t i = 0; i < len; ++i) to[i] = from[i];
+    notify_bulk_write(dst, len);
+    return true;
+}
+
+bool MMU::fill_mem(std::uint16_t dst, std::uint8_t val, std::uint32_t len)
+{
+    if (watched(write_pages, dst, len)) return false;
+
+    std::uint8_t *to = plain_write(dst, len);
+    if (!to) return false;
+
+    for (std::uint32_t i = 0; i < len; ++i) to[i] = val;
+    notify_bulk_write(dst, len);
+    return true;
+}
+
+void MMU::add_watchpoint(const Watchpoint &wp)
+{
+    watchpoints.push_back(wp);
+    update_pages();
+}
+
+void MMU::remove_watchpoint(std::size_t index)
+{
+    watchpoints.erase(watchpoints.begin() + index);
+    update_pages();
+}
+
+void MMU::clear_watchpoints()
+{
+    watchpoints.clear();
+    update_pages();
+}
+
+void MMU::update_pages()
+{
+    read_pages.reset();
+    write_pages.reset();
+    for (const Watchpoint &wp : watchpoints)
+    {
+        for (std::uint32_t page = wp.first >> 8; page <= (std::uint32_t)(wp.last >> 8); ++page)
+        {
+            if (wp.on_read) read_pages.set(page);
+            if (wp.on_write) write_pages.set(page);
+        }
+    }
+    map_all();
+}
+
+bool MMU::watched(const std::bitset<0x100> &pages, std::uint16_t adr, std::uint32_t len) const
+{
+    for (std::uint32_t page = adr >> 8; page <= (adr + len - 1) >> 8; ++page)
+    {
+        if (pages[page & 0xFF]) return true;
+    }
+    return false;
+}
+
+void MMU::check_watchpoints(std::uint16_t adr, std::uint8_t old_val, std::uint8_t new_val, bool write)
+{
+    // A conditional watchpoint might not end up stopping anything, so keep
+    // looking for one that will.
+    for (std::size_t i = 0; i < watchpoints.size(); ++i)
+    {
+        const Watchpoint &wp = watchpoints[i];
+        if (adr < wp.first || adr > wp.last) continue;
+        if (!(write ? wp.on_write : wp.on_read)) continue;
+        if (wp.value >= 0 && wp.value != new_val) continue;
+
+        if (watch_hits.size() < max_watch_hits)
+        {
+            watch_hits.push_back(WatchpointHit{ adr, old_val, new_val, cpu->getPC(), write, i });
+        }
+        attention->set(Attention::watchpoint);
+        if (wp.condition.empty()) return;
+    }
+}
+
+bool MMU::check_watch_conditions(const CPUState &state, std::uint64_t cycles)
+{
+    // Once full, hits that weren't recorded can't be checked.
+    bool full = watch_hits.size() == max_watch_hits;
+
+    std::size_t kept = checked_hits;
+    for (std::size_t i = checked_hits; i < watch_hits.size(); ++i)
+    {
+        const WatchpointHit &hit = watch_hits[i];
+        if (hit.index < watchpoints.size() && !watchpoints[hit.index].condition.evaluate(state, *this, cycles)) continue;
+        watch_hits[kept++] = hit;
+    }
+
+    bool any = kept != checked_hits;
+    watch_hits.resize(kept);
+    checked_hits = kept;
+    return any || full;
 }
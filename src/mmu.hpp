@@ -19,44 +19,185 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define MMU_HPP
 
 #include <array>
+#include <bitset>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <iosfwd>
+#include <vector>
 
-#include "config.hpp"
+#include "condition.hpp"
 
+class Attention;
+class BlockCache;
 class Cart;
+class CPU;
+struct CPUState;
 class InterruptController;
 class GPU;
-class Timer;
+
+// Watches reads and/or writes of an address range, optionally only those of
+// a single value, or only when a condition holds after the instruction.
+struct Watchpoint
+{
+    std::uint16_t first;
+    std::uint16_t last;     // Inclusive.
+    bool on_read;
+    bool on_write;
+    std::int16_t value;     // -1 for any.
+    Condition condition;
+};
+
+struct WatchpointHit
+{
+    std::uint16_t adr;
+    std::uint8_t old_val;   // Same as new_val for reads.
+    std::uint8_t new_val;
+    std::uint16_t PC;       // As it was during the access, so past the op code.
+    bool write;
+    std::size_t index;      // Of the watchpoint hit.
+};
 
 class MMU
 {
 public:
 
-    std::uint8_t read_mem(std::uint16_t adr);
-    void write_mem(std::uint16_t adr, std::uint8_t val);
+    std::uint8_t read_mem(std::uint16_t adr)
+    {
+        const std::uint8_t *page = read_map[adr >> 8];
+        if (page) return page[adr & 0xff];
+        return read_slow(adr);
+    }
+    void write_mem(std::uint16_t adr, std::uint8_t val)
+    {
+        std::uint8_t *page = write_map[adr >> 8];
+        if (page)
+        {
+            page[adr & 0xff] = val;
+            return;
+        }
+        write_slow(adr, val);
+    }
+    // Same as read_mem(), but never hits a watchpoint. For debuggers and
+    // decoding code.
+    std::uint8_t peek_mem(std::uint16_t adr);
+
+    // Same as len calls to write_mem(), for the bulk ops in CPU::run_idiom().
+    // Bytes are copied in increasing address order, like a copy loop would.
+    // Both do nothing and return false unless every byte touched is plain
+    // memory (ROM for reading, VRAM, WRAM and HRAM) within a single region,
+    // and no page touched is being watched.
+    bool copy_mem(std::uint16_t dst, std::uint16_t src, std::uint32_t len);
+    bool fill_mem(std::uint16_t dst, std::uint8_t val, std::uint32_t len);
+
+    // Whether reading adr can give something new just because time passed,
+    // with nothing written in between.
+    static bool is_timed(std::uint16_t adr);
+
+    typedef std::function<std::uint8_t()> IORead;
+    typedef std::function<void(std::uint8_t)> IOWrite;
 
     MMU(Cart *cart,
         GPU *gpu,
         InterruptController *ic,
-        Timer *timer) :
-        cart(cart), gpu(gpu), ic(ic), timer(timer),
-        break_req(false)
+        BlockCache *blocks,
+        Attention *attention,
+        CPU *cpu);
+
+    // Hands the I/O register at adr (0xff00-0xff7f) to a component. Bits
+    // set in unused read as 1 whatever read gives. Registers nothing claims
+    // read back what was last written.
+    void set_io(std::uint16_t adr, IORead read, IOWrite write, std::uint8_t unused = 0);
+
+    // Maps everything in afresh and forgets the watch hits. Needed after the
+    // cart is loaded or reset, as the page table points into it.
+    void reset();
+    // Picks up the cart's current ROM and RAM banks.
+    void map_cart();
+
+    // Makes writes to the pages holding first to last go through
+    // BlockCache::notify_ram_write(), for code the block cache decoded from
+    // RAM. They stay that way until unprotect_code() or reset().
+    void protect_code(std::uint16_t first, std::uint16_t last);
+    void unprotect_code();
+
+    // Accesses that hit a watchpoint are recorded and flag
+    // Attention::watchpoint.
+    void add_watchpoint(const Watchpoint &wp);
+    void remove_watchpoint(std::size_t index);
+    void clear_watchpoints();
+    const std::vector<Watchpoint>& getWatchpoints() const { return watchpoints; }
+
+    // Oldest first. Only the first max_watch_hits are kept until cleared.
+    const std::vector<WatchpointHit>& getWatchHits() const { return watch_hits; }
+    void clear_watch_hits()
     {
-        for (std::int32_t &adr : breakpoints) adr = -1;
+        watch_hits.clear();
+        checked_hits = 0;
     }
+    static const std::size_t max_watch_hits = 256;
 
-    bool break_req;
-    std::int32_t breakpoints[NUM_MEM_BREAKPOINTS];
+    // Drops the hits since the last call whose watchpoint's condition
+    // doesn't hold now. Returns whether any were kept, or the list was full
+    // so some may have gone unrecorded.
+    bool check_watch_conditions(const CPUState &state, std::uint64_t cycles);
 
 private:
+    // Host memory behind each 256 byte page, or nullptr where an access
+    // needs more than a load or store. The base maps only follow what's
+    // mapped in. read_map and write_map, which read_mem() and write_mem()
+    // go through, also leave out watched pages and, for writes, pages with
+    // cached code. They come first, next to the CPU in System.
+    std::array<const std::uint8_t*, 0x100> read_map;
+    std::array<std::uint8_t*, 0x100> write_map;
+    std::array<const std::uint8_t*, 0x100> base_read;
+    std::array<std::uint8_t*, 0x100> base_write;
+    std::bitset<0x100> code_pages;
+
     Cart *cart;
     GPU *gpu;
     InterruptController *ic;
-    Timer *timer;
+    BlockCache *blocks;
+    Attention *attention;
+    CPU *cpu;
     std::array<std::uint8_t, 0x2000> loram;
-    std::array<std::uint8_t, 0x79> hiram;
+    std::array<std::uint8_t, 0x7f> hiram;
+
+    void map_page(std::uint32_t page);
+    void map_all();
+    // The switchable ROM bank at 0x4000-0x7fff and the RAM at 0xa000-0xbfff.
+    void map_rom_bank();
+    void map_ram_bank();
+
+    std::uint8_t read_slow(std::uint16_t adr);
+    void write_slow(std::uint16_t adr, std::uint8_t val);
+    std::uint8_t read_handler(std::uint16_t adr);
+    void write_handler(std::uint16_t adr, std::uint8_t val);
+
+    const std::uint8_t* plain_read(std::uint16_t adr, std::uint32_t len);
+    std::uint8_t* plain_write(std::uint16_t adr, std::uint32_t len);
+    void notify_bulk_write(std::uint16_t dst, std::uint32_t len);
+
+    // Pages of 256 bytes with a watchpoint on them. These are left out of
+    // the page table, so accesses to the rest don't pay for watching.
+    std::vector<Watchpoint> watchpoints;
+    std::bitset<0x100> read_pages;
+    std::bitset<0x100> write_pages;
+    std::vector<WatchpointHit> watch_hits;
+    std::size_t checked_hits;
+
+    void update_pages();
+    bool watched(const std::bitset<0x100> &pages, std::uint16_t adr, std::uint32_t len) const;
+    std::uint8_t watched_read(std::uint16_t adr);
+    void check_watchpoints(std::uint16_t adr, std::uint8_t old_val, std::uint8_t new_val, bool write);
+
+    struct IOPort
+    {
+        IORead read;
+        IOWrite write;
+        std::uint8_t unused;
+    };
+    std::array<IOPort, 0x80> io_ports;
 
     // Temporary until all registers are implemented.
     std::array<std::uint8_t, 0x80> ioshadow;
@@ -0,0 +1,267 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "recompiler.hpp"
+
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+
+#include "cart.hpp"
+
+static const char *const r8_names[8] = { "B", "C", "D", "E", "H", "L", nullptr, "A" };
+static const char *const r16_names[4] = { "BC", "DE", "HL", "SP" };
+
+static std::string hex(unsigned val, int width)
+{
+    std::ostringstream out;
+    out << std::hex << std::setfill('0') << std::setw(width) << val;
+    return out.str();
+}
+
+static std::uint16_t bank_of(std::uint16_t adr)
+{
+    // Bank 1 is the one mapped at power on.
+    return adr < 0x4000 ? 0 : 1;
+}
+
+// Addresses control can go to once the block is done, as far as can be told
+// without running it.
+static std::vector<std::uint16_t> successors(const FoundBlock &block)
+{
+    std::vector<std::uint16_t> out;
+
+    std::uint16_t next = block.adr;
+    for (const BlockOp &op : block.ops) next += op.length;
+
+    const BlockOp &last = block.ops.back();
+    std::uint8_t op_code = last.op_code;
+    std::uint16_t imm16 = (std::uint16_t)(last.imm[0] | last.imm[1] << 8);
+
+    if (!ends_block(op_code))
+    {
+        // Cut short by the size limit or the end of the bank.
+        out.push_back(next);
+        return out;
+    }
+
+    if (op_code == 0x18 || (op_code & 0xE7) == 0x20)
+    {
+        // JR, JR cc
+        out.push_back((std::uint16_t)(next + (std::int8_t)last.imm[0]));
+        if (op_code != 0x18) out.push_back(next);
+    }
+    else if (op_code == 0xc3 || op_code == 0xcd || (op_code & 0xE7) == 0xC2 || (op_code & 0xE7) == 0xC4)
+    {
+        // JP, CALL, JP cc, CALL cc. Calls are assumed to return.
+        out.push_back(imm16);
+        if (op_code != 0xc3) out.push_back(next);
+    }
+    else if ((op_code & 0xC7) == 0xC7)
+    {
+        // RST
+        out.push_back(op_code & 0x38);
+        out.push_back(next);
+    }
+    else if ((op_code & 0xE7) == 0xC0 || op_code == 0x76 || op_code == 0x10)
+    {
+        // RET cc, HALT, STOP
+        out.push_back(next);
+    }
+
+    return out;
+}
+
+std::map<std::uint32_t, FoundBlock> find_blocks(Cart &cart)
+{
+    std::map<std::uint32_t, FoundBlock> found;
+    std::vector<std::uint16_t> todo = { 0x100 };
+    for (std::uint16_t vec = 0; vec <= 0x60; vec += 8) todo.push_back(vec);
+
+    while (!todo.empty())
+    {
+        std::uint16_t adr = todo.back();
+        todo.pop_back();
+        if (adr >= 0x8000) continue;
+
+        std::uint32_t key = (std::uint32_t)bank_of(adr) << 16 | adr;
+        if (found.count(key)) continue;
+
+        FoundBlock block;
+        block.bank = bank_of(adr);
+        block.adr = adr;
+        block.ops = decode_block([&cart](std::uint16_t a) { return cart.readROM(a); },
+            adr, adr < 0x4000 ? 0x4000 : 0x8000);
+        if (block.ops.empty()) continue;
+
+        for (std::uint16_t succ : successors(block)) todo.push_back(succ);
+        found[key] = block;
+    }
+
+    return found;
+}
+
+// ALU A, R8 and ALU A, d8, except for ADC/SBC and (HL).
+static bool alu_native(std::uint8_t op_code)
+{
+    int bits = (op_code >> 3) & 7;
+    if (bits == 1 || bits == 3) return false;
+    return (op_code >= 0x80 && op_code < 0xc0 && (op_code & 7) != 6) || (op_code & 0xC7) == 0xC6;
+}
+
+// Writes C++ for ops that only touch registers, flags, PC and the cycle count,
+// the same set the JIT handles without calling back.
+static bool emit_native(std::ostream &out, const BlockOp &op)
+{
+    std::uint8_t op_code = op.op_code;
+    std::uint16_t imm16 = (std::uint16_t)(op.imm[0] | op.imm[1] << 8);
+    int cycles;
+    int pc_delta;
+
+    if (op_code == 0x00)
+    {
+        cycles = 1;
+        pc_delta = 1;
+    }
+    else if (op_code == 0xf3 || op_code == 0xfb)
+    {
+        out << "    *ctx->ime = " << (op_code == 0xfb ? "true" : "false") << ";\n";
+        cycles = 1;
+        pc_delta = 1;
+    }
+    else if (op_code >= 0x40 && op_code < 0x80 && (op_code & 7) != 6 && ((op_code >> 3) & 7) != 6)
+    {
+        out << "    r8[(int)REG8::" << r8_names[(op_code >> 3) & 7] << "] = r8[(int)REG8::" << r8_names[op_code & 7] << "];\n";
+        cycles = 1;
+        pc_delta = 1;
+    }
+    else if ((op_code & 0xC7) == 0x06 && op_code != 0x36)
+    {
+        out << "    r8[(int)REG8::" << r8_names[op_code >> 3] << "] = 0x" << hex(op.imm[0], 2) << ";\n";
+        cycles = 2;
+        pc_delta = 2;
+    }
+    else if ((op_code & 0xCF) == 0x01)
+    {
+        out << "    r16[(int)REG16::" << r16_names[op_code >> 4] << "] = 0x" << hex(imm16, 4) << ";\n";
+        cycles = 3;
+        pc_delta = 3;
+    }
+    else if ((op_code & 0xC7) == 0x03)
+    {
+        out << "    " << ((op_code & 0x08) ? "--" : "++") << "r16[(int)REG16::" << r16_names[op_code >> 4] << "];\n";
+        cycles = 2;
+        pc_delta = 1;
+    }
+    else if (alu_native(op_code))
+    {
+        int bits = (op_code >> 3) & 7;
+        std::string src = op_code >= 0xc0 ?
+            "0x" + hex(op.imm[0], 2) :
+            std::string("r8[(int)REG8::") + r8_names[op_code & 7] + "]";
+
+        if (bits >= 4 && bits <= 6)
+        {
+            static const char *const logic[3] = { "&", "^", "|" };
+            out << "    aot_logic(ctx, (std::uint8_t)(r8[(int)REG8::A] " << logic[bits - 4] << ' ' << src << "), " <<
+                (bits == 4 ? "true" : "false") << ");\n";
+        }
+        else
+        {
+            out << "    aot_add(ctx, " << src << ", " << (bits != 0 ? "true" : "false") << ", " <<
+                (bits != 7 ? "true" : "false") << ");\n";
+        }
+        cycles = op_code >= 0xc0 ? 2 : 1;
+        pc_delta = cycles;
+    }
+    else if (op_code == 0xc3)
+    {
+        out << "    r16[(int)REG16::PC] = 0x" << hex(imm16, 4) << ";\n";
+        cycles = 4;
+        pc_delta = 0;
+    }
+    else if (op_code == 0x18)
+    {
+        cycles = 3;
+        pc_delta = 2 + (std::int8_t)op.imm[0];
+    }
+    else
+    {
+        return false;
+    }
+
+    out << "    *ctx->cycles += " << cycles << ";\n";
+    if (pc_delta) out << "    r16[(int)REG16::PC] += " << pc_delta << ";\n";
+    return true;
+}
+
+static void emit_block(std::ostream &out, const FoundBlock &block)
+{
+    std::string name = hex(block.bank, 2) + '_' + hex(block.adr, 4);
+
+    out << "static const BlockOp ops_" << name << "[] = {\n";
+    for (const BlockOp &op : block.ops)
+    {
+        out << "    { 0x" << hex(op.op_code, 2) << ", { 0x" << hex(op.imm[0], 2) << ", 0x" << hex(op.imm[1], 2) <<
+            " }, " << (int)op.length << " },\n";
+    }
+    out << "};\n\n";
+
+    std::ostringstream body;
+    std::uint16_t adr = block.adr;
+    for (std::size_t i = 0; i < block.ops.size(); ++i)
+    {
+        const BlockOp &op = block.ops[i];
+        body << "\n    // " << hex(adr, 4) << ": " << hex(op.op_code, 2);
+        for (int b = 1; b < op.length; ++b) body << ' ' << hex(op.imm[b - 1], 2);
+        body << "\n    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;\n";
+
+        if (!emit_native(body, op))
+        {
+            body << "    if (ctx->run_op(ctx->cpu, &ops_" << name << '[' << i << "])) return;\n";
+        }
+        adr += op.length;
+    }
+
+    // Only declare the register pointers that are used, unused ones would warn.
+    std::string code = body.str();
+    out << "static void block_" << name << "(const AOTContext *ctx)\n{\n";
+    if (code.find("r8[") != std::string::npos) out << "    std::uint8_t *r8 = ctx->r8;\n";
+    if (code.find("r16[") != std::string::npos) out << "    std::uint16_t *r16 = ctx->r16;\n";
+    out << code << "}\n\n";
+}
+
+void write_plugin(std::ostream &out, Cart &cart, const std::map<std::uint32_t, FoundBlock> &blocks)
+{
+    out << "// Recompiled from " << cart.getHeader().title << " by gb-recompile, do not edit.\n\n";
+    out << "#include \"aot.hpp\"\n\n";
+
+    for (const auto &block : blocks) emit_block(out, block.second);
+
+    out << "static const AOTBlock blocks[] = {\n";
+    for (const auto &block : blocks)
+    {
+        const FoundBlock &b = block.second;
+        std::string name = hex(b.bank, 2) + '_' + hex(b.adr, 4);
+        out << "    { " << b.bank << ", 0x" << hex(b.adr, 4) << ", " << b.ops.size() << ", ops_" << name << ", &block_" << name << " },\n";
+    }
+    out << "};\n\n";
+
+    out << "static const AOTPlugin plugin = { AOT_VERSION, 0x" << hex(cart.getHeader().global_checksum, 4) << ", " <<
+        blocks.size() << ", blocks };\n\n";
+    out << "AOT_EXPORT const AOTPlugin* gb_aot_plugin()\n{\n    return &plugin;\n}\n";
+}
@@ -0,0 +1,49 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RECOMPILER_HPP
+#define RECOMPILER_HPP
+
+// Ahead of time recompiler, used by gb-recompile. Follows the control flow of
+// a ROM from the entry point and the RST and interrupt vectors, and writes
+// every block it finds out as C++ for an AOT plugin (see aot.hpp). Only the
+// banks mapped at power on are followed, code in other banks or in RAM is
+// left to the interpreter.
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <vector>
+
+#include "block_cache.hpp"
+
+class Cart;
+
+struct FoundBlock
+{
+    std::uint16_t bank;
+    std::uint16_t adr;
+    std::vector<BlockOp> ops;
+};
+
+// Keyed by bank << 16 | adr.
+std::map<std::uint32_t, FoundBlock> find_blocks(Cart &cart);
+
+// Writes the source of the plugin for cart's blocks.
+void write_plugin(std::ostream &out, Cart &cart, const std::map<std::uint32_t, FoundBlock> &blocks);
+
+#endif
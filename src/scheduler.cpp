@@ -0,0 +1,75 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cassert>
+
+#include "scheduler.hpp"
+
+Scheduler::Scheduler()
+{
+    reset();
+}
+
+void Scheduler::reset()
+{
+    cycles = 0;
+    for (std::uint64_t &when : due) when = never;
+    find_next();
+}
+
+void Scheduler::set_handler(Event ev, Handler handler)
+{
+    handlers[(std::size_t)ev] = handler;
+}
+
+void Scheduler::schedule(Event ev, std::uint64_t when)
+{
+    assert(when > cycles);
+    due[(std::size_t)ev] = when;
+    find_next();
+}
+
+void Scheduler::cancel(Event ev)
+{
+    due[(std::size_t)ev] = never;
+    find_next();
+}
+
+void Scheduler::run_next()
+{
+    // The handler will often schedule its event again, so it's taken off
+    // first.
+    std::size_t index = next_index;
+    cycles = next;
+    due[index] = never;
+    find_next();
+    handlers[index]();
+}
+
+void Scheduler::find_next()
+{
+    next = never;
+    next_index = 0;
+    for (std::size_t i = 0; i < num_events; ++i)
+    {
+        if (due[i] < next)
+        {
+            next = due[i];
+            next_index = i;
+        }
+    }
+}
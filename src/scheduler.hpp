@@ -0,0 +1,90 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Things that happen at a known cycle without the CPU doing anything. Each
+// kind can only be scheduled once at a time, scheduling it again moves it.
+enum class Event
+{
+    timer,          // TIMA overflows and raises the timer interrupt.
+    run_end,        // System::run_until() has run for long enough.
+};
+
+static const std::size_t num_events = 2;
+
+// Keeps the master clock and runs each event's handler when the clock
+// reaches it, so components only do work when something actually changes
+// instead of being stepped every cycle.
+class Scheduler
+{
+public:
+    typedef std::function<void()> Handler;
+
+    static const std::uint64_t never = UINT64_MAX;
+
+    Scheduler();
+
+    // Sets the clock back to 0 and cancels everything. Handlers stay set.
+    void reset();
+
+    // Machine cycles since reset.
+    std::uint64_t now() const { return cycles; }
+    // Cycle of the next event, or never.
+    std::uint64_t next_event() const { return next; }
+    // Cycles from now to the next event, saturated to 32 bits.
+    std::uint32_t cycles_to_event() const
+    {
+        std::uint64_t left = next - cycles;
+        return left > UINT32_MAX ? UINT32_MAX : (std::uint32_t)left;
+    }
+
+    void set_handler(Event ev, Handler handler);
+    // when must be after now.
+    void schedule(Event ev, std::uint64_t when);
+    void cancel(Event ev);
+
+    // Moves the clock forward, running the handlers of the events passed on
+    // the way in order. The clock reads an event's cycle while its handler runs.
+    void advance(std::uint64_t delta)
+    {
+        std::uint64_t end = cycles + delta;
+        while (next <= end) run_next();
+        cycles = end;
+    }
+
+private:
+    std::uint64_t cycles;
+    std::uint64_t next;
+    std::size_t next_index;
+
+    // With only a handful of kinds a slot each is both simpler and quicker
+    // than a heap.
+    std::array<std::uint64_t, num_events> due;
+    std::array<Handler, num_events> handlers;
+
+    void run_next();
+    void find_next();
+};
+
+#endif
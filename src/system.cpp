@@ -15,54 +15,210 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <array>
 #include <istream>
+#include <sstream>
+#include <stdexcept>
 
 #include "system.hpp"
 
 System::System() :
-    timer(&ic),
-    mmu(&cart, &gpu, &ic, &timer),
-    cpu(&mmu, &ic)
+    cpu_mode(CPUMode::microcode),
+    cpu(&mmu, &ic, &attention, &scheduler, &timer, &blocks, &jit),
+    mmu(&cart, &gpu, &ic, &blocks, &attention, &cpu),
+    cart(&scheduler),
+    ic(&attention),
+    timer(&ic, &scheduler),
+    blocks(&mmu, &cart),
+    jit(&cpu, &blocks)
 {
-    for (std::int32_t &bp : breakpoints) bp = -1;
+    scheduler.set_handler(Event::run_end, [this]() { attention.set(Attention::run_end); });
+    ic.map_io(mmu);
+    timer.map_io(mmu);
     reset();
 }
 
 void System::reset()
 {
+    scheduler.reset();
     cart.reset();
     timer.reset();
+    blocks.reset();
+    mmu.reset();
     cpu.reset();
+    attention.clear(Attention::run_stop);
+    shadow.reset();
+}
+
+bool System::loadAOT(const std::string &dir)
+{
+    blocks.set_aot(nullptr);
+    const AOTPlugin *plugin = aot.load(dir, cart.getHeader().global_checksum);
+    blocks.set_aot(plugin);
+    return plugin != nullptr;
 }
 
 void System::step()
 {
+    if (cpu_mode == CPUMode::instruction)
+    {
+        cpu.execute();
+        return;
+    }
+
+    if (cpu_mode == CPUMode::block)
+    {
+        cpu.run_block();
+        return;
+    }
+
+    if (cpu_mode == CPUMode::jit)
+    {
+        cpu.run_jit();
+        return;
+    }
+
+    if (cpu_mode == CPUMode::jit_check)
+    {
+        if (!shadow) make_shadow();
+
+        cpu.run_jit();
+
+        // The microcode engine goes an instruction at a time, so catch it up
+        // to the end of the block. If it stops moving it's disagreeing.
+        while (shadow->cycles() < cycles())
+        {
+            std::uint64_t before = shadow->cycles();
+            shadow->step();
+            if (shadow->cycles() == before) break;
+        }
+        checkShadow();
+        return;
+    }
+
+    // A stopped CPU does nothing and the timer is paused along with it, but
+    // a run still has to reach its end. Skip to the next event.
+    if (cpu.isStopped())
+    {
+        if (!(attention.get() & Attention::run_stop))
+        {
+            std::uint32_t cycles = scheduler.cycles_to_event();
+            if (cycles > CPU::max_idle_skip) cycles = CPU::max_idle_skip;
+            scheduler.advance(cycles);
+        }
+        return;
+    }
+
+    // A halted CPU does nothing until an interrupt is pending, go straight to
+    // the next event.
+    if (cpu.isHalting() && !ic.interrupt_pending() && !(attention.get() & Attention::run_stop))
+    {
+        // Not std::min(), which would need max_idle_skip defined somewhere
+        // to take a reference to it.
+        std::uint32_t cycles = scheduler.cycles_to_event();
+        if (cycles > CPU::max_idle_skip) cycles = CPU::max_idle_skip;
+        if (cycles > 1) scheduler.advance(cycles - 1);
+    }
+
     do
     {
-        timer.step();
+        scheduler.advance(1);
         cpu.step();
     } while (!cpu.isFetching());
 }
 
-void System::run()
+StopReason System::run()
+{
+    return run_loop();
+}
+
+StopReason System::run_until(std::uint64_t cycle)
 {
+    if (cycle <= scheduler.now()) return StopReason::done;
+
+    scheduler.schedule(Event::run_end, cycle);
+    cpu.events_changed();
+    StopReason reason = run_loop();
+    scheduler.cancel(Event::run_end);
+    return reason;
+}
+
+StopReason System::run_loop()
+{
+    // PC breakpoints are only looked for if there are any, everything else
+    // that stops the loop is flagged in the attention word.
+    bool pc_breakpoints = !breakpoints.empty();
+
+    std::uint32_t flags;
+    bool pc_hit;
     do
     {
-        step();
-    } while (!checkBreakpoints());
+        // With nothing to check between instructions the CPU can run them
+        // back to back on its own.
+        if (cpu_mode == CPUMode::instruction && !pc_breakpoints) cpu.run_instructions();
+        else step();
+        flags = attention.get() & Attention::run_stop;
+        pc_hit = pc_breakpoints && breakpoints.contains(cpu.getPC()) &&
+            breakpoints.getCondition(cpu.getPC()).evaluate(cpu.getState(), mmu, scheduler.now());
+
+        // Watchpoint conditions are checked here rather than on the access,
+        // so they see the whole instruction done.
+        if ((flags & Attention::watchpoint) && !mmu.check_watch_conditions(cpu.getState(), scheduler.now()))
+        {
+            attention.clear(Attention::watchpoint);
+            flags &= ~Attention::watchpoint;
+        }
+    } while (!flags && !pc_hit);
+
+    attention.clear(Attention::run_stop);
+
+    if (flags & Attention::watchpoint) return StopReason::watchpoint;
+    if (pc_hit) return StopReason::breakpoint;
+    if (flags & Attention::host_stop) return StopReason::host_stop;
+    return StopReason::done;
 }
 
-bool System::checkBreakpoints()
+void System::make_shadow()
 {
-    if (mmu.break_req)
-    {
-        mmu.break_req = false;
-        return true;
-    }
-    for (std::int32_t adr : breakpoints)
+    // Copying the timer and the CPU partway through an instruction isn't
+    // possible from outside, but at the start there's only what the host
+    // has set up to copy.
+    if (scheduler.now() != 0) throw std::logic_error("jit_check has to be picked before the first step");
+
+    shadow.reset(new System());
+    shadow->cart = cart;
+    shadow->mmu.map_cart();
+    shadow->cpu_mode = CPUMode::microcode;
+
+    for (std::uint32_t adr = 0x8000; adr < 0xa000; ++adr) shadow->mmu.write_mem((std::uint16_t)adr, mmu.peek_mem((std::uint16_t)adr));
+    for (std::uint32_t adr = 0xc000; adr < 0xe000; ++adr) shadow->mmu.write_mem((std::uint16_t)adr, mmu.peek_mem((std::uint16_t)adr));
+    for (std::uint32_t adr = 0xfe00; adr < 0xfea0; ++adr) shadow->mmu.write_mem((std::uint16_t)adr, mmu.peek_mem((std::uint16_t)adr));
+    for (std::uint32_t adr = 0xff80; adr < 0xffff; ++adr) shadow->mmu.write_mem((std::uint16_t)adr, mmu.peek_mem((std::uint16_t)adr));
+
+    // TMA, TAC and TIMA. DIV is zero on both.
+    for (std::uint16_t adr = 0xff05; adr < 0xff08; ++adr) shadow->mmu.write_mem(adr, mmu.peek_mem(adr));
+    shadow->ic.setIF(ic.getIF());
+    shadow->ic.setIE(ic.getIE());
+
+    shadow->cpu.setState(cpu.getState());
+}
+
+void System::checkShadow()
+{
+    CPUState a = cpu.getState();
+    CPUState b = shadow->cpu.getState();
+
+    if (a.A != b.A || a.F != b.F || a.B != b.B || a.C != b.C ||
+        a.D != b.D || a.E != b.E || a.H != b.H || a.L != b.L ||
+        a.PC != b.PC || a.SP != b.SP || a.ime != b.ime ||
+        timer.getDIV() != shadow->timer.getDIV() ||
+        timer.getTIMA() != shadow->timer.getTIMA() ||
+        ic.getIF() != shadow->ic.getIF() ||
+        cycles() != shadow->cycles())
     {
-        if (cpu.getPC() == adr) return true;
+        std::ostringstream msg;
+        msg << "JIT and interpreter disagree at PC " << std::hex << b.PC;
+        throw std::runtime_error(msg.str());
     }
-    return false;
 }
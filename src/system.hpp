@@ -20,35 +20,96 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <cstdint>
 #include <iosfwd>
+#include <memory>
+#include <string>
 
+#include "aot_library.hpp"
+#include "attention.hpp"
+#include "block_cache.hpp"
+#include "breakpoint_set.hpp"
 #include "cart.hpp"
-#include "config.hpp"
 #include "cpu.hpp"
 #include "gpu.hpp"
 #include "interrupt_controller.hpp"
+#include "jit.hpp"
 #include "mmu.hpp"
+#include "scheduler.hpp"
 #include "timer.hpp"
 
+enum class CPUMode
+{
+    microcode,      // Step the CPU one machine cycle at a time.
+    instruction,    // Run whole instructions at once, faster but can't stop mid instruction.
+    block,          // Run cached blocks of instructions, breakpoints are only checked between blocks.
+    jit,            // Same as block, but hot blocks are compiled to native code where supported.
+    jit_check,      // Same as jit, with a copy of the system running each block through the
+                    // microcode engine and a runtime_error thrown if they disagree. Must be
+                    // picked before the first step, a logic_error is thrown otherwise.
+};
+
+// Why one of the run functions returned.
+enum class StopReason
+{
+    done,           // Ran for as long as asked.
+    breakpoint,     // PC reached one of the breakpoints.
+    watchpoint,     // One of the MMU's watchpoints was hit, see MMU::getWatchHits().
+    host_stop,      // request_stop() was called.
+};
+
 class System
 {
 public:
+    // There's no PPU yet to count frames, so a frame is the number of machine
+    // cycles one takes.
+    static const std::uint32_t cycles_per_frame = 17556;
+
     System();
 
     void reset();
     void step();
-    void run();
+    // Runs until a breakpoint is hit or request_stop() is called.
+    StopReason run();
+    // Same as run(), but also stops once the clock reaches the given cycle.
+    // Instructions, and blocks in the block modes, are never cut short, so
+    // it can go a little past.
+    StopReason run_until(std::uint64_t cycle);
+    StopReason run_for(std::uint64_t cycles) { return run_until(scheduler.now() + cycles); }
+    StopReason run_frames(std::uint32_t frames) { return run_for((std::uint64_t)frames * cycles_per_frame); }
+    // Makes the run functions return after the current instruction. Safe to
+    // call from another thread.
+    void request_stop() { attention.set(Attention::host_stop); }
 
-    std::int32_t breakpoints[NUM_BREAKPOINTS];
+    // Machine cycles since reset.
+    std::uint64_t cycles() const { return scheduler.now(); }
 
+    // Load the AOT plugin for the current cart from dir, if there is one.
+    // Returns false if none was loaded. Call again after loading a new cart.
+    bool loadAOT(const std::string &dir);
+
+    // PC breakpoints, checked between steps of the run functions.
+    BreakpointSet breakpoints;
+    CPUMode cpu_mode;
+
+    // What every instruction touches is kept together: the attention word,
+    // the clock, the CPU's registers and the MMU's page tables.
+    Attention attention;
+    Scheduler scheduler;
+    CPU cpu;
+    MMU mmu;
     Cart cart;
     GPU gpu;
     InterruptController ic;
     Timer timer;
-    MMU mmu;
-    CPU cpu;
+    AOTLibrary aot;
+    BlockCache blocks;
+    JIT jit;
 
 private:
-    bool checkBreakpoints();
+    StopReason run_loop();
+
+    std::unique_ptr<System> shadow;
+    void make_shadow();
+    void checkShadow();
 };
 
 #endif
@@ -18,33 +18,118 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "timer.hpp"
 
 #include "interrupt_controller.hpp"
+#include "mmu.hpp"
+#include "scheduler.hpp"
 
-const std::uint8_t Timer::TIMA_tick_mask[4] = { 256-1, 4-1, 16-1, 64-1 };
+const std::uint8_t Timer::TIMA_tick_shift[4] = { 8, 2, 4, 6 };
+
+Timer::Timer(InterruptController *ic, Scheduler *scheduler) :
+    ic(ic), scheduler(scheduler)
+{
+    scheduler->set_handler(Event::timer, [this]() { overflow(); });
+}
+
+void Timer::map_io(MMU &mmu)
+{
+    mmu.set_io(DIV_ADR, [this]() { return getDIV(); }, [this](std::uint8_t val) { setDIV(val); });
+    mmu.set_io(TIMA_ADR, [this]() { return getTIMA(); }, [this](std::uint8_t val) { setTIMA(val); });
+    mmu.set_io(TMA_ADR, [this]() { return TMA; }, [this](std::uint8_t val) { setTMA(val); });
+    mmu.set_io(TAC_ADR, [this]() { return TAC; }, [this](std::uint8_t val) { setTAC(val); }, TAC_unused);
+}
 
 void Timer::reset()
 {
-    cycle = 0;
-    DIV = 0;
-    TIMA = 0;
     TMA = 0;
     TAC = 0;
+    origin = scheduler->now();
+    DIV_offset = 0;
+    TIMA_base = 0;
+    TIMA_synced = origin;
+    paused = false;
+    schedule_overflow();
+}
+
+void Timer::setDIV(std::uint8_t)
+{
+    // Any write sets it back to 0.
+    DIV_offset = (std::uint8_t)(0 - ((counted_to() - origin) >> DIV_tick_shift));
+}
+
+void Timer::setTIMA(std::uint8_t val)
+{
+    TIMA_base = val;
+    TIMA_synced = counted_to();
+    schedule_overflow();
+}
+
+void Timer::setTAC(std::uint8_t val)
+{
+    // TIMA counted at the old speed up to now.
+    sync_TIMA();
+    TAC = val;
+    schedule_overflow();
+}
+
+std::uint8_t Timer::getDIV() const
+{
+    return (std::uint8_t)(DIV_offset + ((counted_to() - origin) >> DIV_tick_shift));
 }
 
-void Timer::step()
+std::uint8_t Timer::getTIMA() const
 {
-    ++cycle;
+    if (!(TAC & TAC_start_mask)) return TIMA_base;
+    // Overflows are events, so TIMA can't have wrapped since it was synced.
+    return (std::uint8_t)(TIMA_base + TIMA_ticks(counted_to()) - TIMA_ticks(TIMA_synced));
+}
 
-    if (0 == (cycle & DIV_tick_mask)) DIV++;
+std::uint64_t Timer::counted_to() const
+{
+    return paused ? paused_at : scheduler->now();
+}
 
-    if (TAC & TAC_start_mask)
+void Timer::pause()
+{
+    if (paused) return;
+    paused_at = scheduler->now();
+    paused = true;
+    scheduler->cancel(Event::timer);
+}
+
+void Timer::resume()
+{
+    if (!paused) return;
+    // Moving the counters' start along by the time spent paused carries on
+    // from the same point in their periods.
+    std::uint64_t gap = scheduler->now() - paused_at;
+    origin += gap;
+    TIMA_synced += gap;
+    paused = false;
+    schedule_overflow();
+}
+
+void Timer::sync_TIMA()
+{
+    TIMA_base = getTIMA();
+    TIMA_synced = counted_to();
+}
+
+void Timer::overflow()
+{
+    TIMA_base = TMA;
+    TIMA_synced = scheduler->now();
+    ic->signal_timer_irq();
+    schedule_overflow();
+}
+
+void Timer::schedule_overflow()
+{
+    if (paused || !(TAC & TAC_start_mask))
     {
-        if (0 == (cycle & TIMA_tick_mask[TAC & TAC_speed_mask]))
-        {
-            if (++TIMA == 0)
-            {
-                TIMA = TMA;
-                ic->signal_timer_irq();
-            }
-        }
+        scheduler->cancel(Event::timer);
+        return;
     }
+    // TIMA overflows on the tick that takes it past 0xFF.
+    std::uint8_t shift = TIMA_tick_shift[TAC & TAC_speed_mask];
+    std::uint64_t tick = TIMA_ticks(TIMA_synced) + (0x100u - TIMA_base);
+    scheduler->schedule(Event::timer, origin + (tick << shift));
 }
@@ -26,41 +26,73 @@ static const std::uint16_t TMA_ADR = 0xff06;
 static const std::uint16_t TAC_ADR = 0xff07;
 
 class InterruptController;
+class MMU;
+class Scheduler;
 
+// Runs off the scheduler's clock. DIV and TIMA aren't counted, they're
+// worked out from how many cycles have passed when they're read, and the
+// cycle TIMA overflows on is scheduled as an event.
 class Timer
 {
 public:
-    Timer(InterruptController *ic) :
-        ic(ic)
-    {}
+    Timer(InterruptController *ic, Scheduler *scheduler);
 
     void reset();
-    void step();
+    // Puts DIV, TIMA, TMA and TAC in the MMU's I/O table.
+    void map_io(MMU &mmu);
 
-    void setDIV(std::uint8_t) { DIV = 0; }
-    void setTIMA(std::uint8_t val) { TIMA = val; }
+    void setDIV(std::uint8_t);
+    void setTIMA(std::uint8_t val);
     void setTMA(std::uint8_t val) { TMA = val; }
-    void setTAC(std::uint8_t val) { TAC = val; }
-    std::uint8_t getDIV() const { return DIV; }
-    std::uint8_t getTIMA() const { return TIMA; }
+    void setTAC(std::uint8_t val);
+
+    std::uint8_t getDIV() const;
+    std::uint8_t getTIMA() const;
+
+    // Stops DIV and TIMA for the CPU's STOP mode, and starts them again where
+    // they left off. The scheduler's clock keeps going meanwhile.
+    void pause();
+    void resume();
     std::uint8_t getTMA() const { return TMA; }
     std::uint8_t getTAC() const { return TAC | TAC_unused; }
 
 private:
-    static const std::uint8_t DIV_tick_mask = 64 - 1;
-    static const std::uint8_t TIMA_tick_mask[4];
+    static const std::uint8_t DIV_tick_shift = 6;
+    static const std::uint8_t TIMA_tick_shift[4];
     static const std::uint8_t TAC_start_mask = 0x04;
     static const std::uint8_t TAC_speed_mask = 0x03;
     static const std::uint8_t TAC_unused = 0xF8;
 
-    std::uint8_t DIV;
-    std::uint8_t TIMA;
     std::uint8_t TMA;
     std::uint8_t TAC;
 
-    std::uint8_t cycle;
+    // Both counters tick on multiples of their period counted from the cycle
+    // of the last reset.
+    std::uint64_t origin;
+    // Added to the DIV ticks since origin, so writes can set it back to 0.
+    std::uint8_t DIV_offset;
+    // TIMA as of TIMA_synced, the last write to it or TAC, or overflow.
+    std::uint8_t TIMA_base;
+    std::uint64_t TIMA_synced;
+
+    bool paused;
+    std::uint64_t paused_at;
+
+    // The cycle the counters have got up to, which stays put while paused.
+    std::uint64_t counted_to() const;
 
     InterruptController *ic;
+    Scheduler *scheduler;
+
+    // TIMA ticks from origin up to the given cycle.
+    std::uint64_t TIMA_ticks(std::uint64_t cycle) const
+    {
+        return (cycle - origin) >> TIMA_tick_shift[TAC & TAC_speed_mask];
+    }
+
+    void sync_TIMA();
+    void overflow();
+    void schedule_overflow();
 };
 
 #endif
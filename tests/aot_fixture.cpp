@@ -0,0 +1,471 @@
+// Recompiled from TEST by gb-recompile, do not edit.
+
+#include "aot.hpp"
+
+static const BlockOp ops_00_0000[] = {
+    { 0xd9, { 0x00, 0x00 }, 1 },
+};
+
+static void block_00_0000(const AOTContext *ctx)
+{
+
+    // 0000: d9
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0000[0])) return;
+}
+
+static const BlockOp ops_00_0008[] = {
+    { 0xd9, { 0x00, 0x00 }, 1 },
+};
+
+static void block_00_0008(const AOTContext *ctx)
+{
+
+    // 0008: d9
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0008[0])) return;
+}
+
+static const BlockOp ops_00_0010[] = {
+    { 0xd9, { 0x00, 0x00 }, 1 },
+};
+
+static void block_00_0010(const AOTContext *ctx)
+{
+
+    // 0010: d9
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0010[0])) return;
+}
+
+static const BlockOp ops_00_0018[] = {
+    { 0xd9, { 0x00, 0x00 }, 1 },
+};
+
+static void block_00_0018(const AOTContext *ctx)
+{
+
+    // 0018: d9
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0018[0])) return;
+}
+
+static const BlockOp ops_00_0020[] = {
+    { 0xd9, { 0x00, 0x00 }, 1 },
+};
+
+static void block_00_0020(const AOTContext *ctx)
+{
+
+    // 0020: d9
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0020[0])) return;
+}
+
+static const BlockOp ops_00_0028[] = {
+    { 0xd9, { 0x00, 0x00 }, 1 },
+};
+
+static void block_00_0028(const AOTContext *ctx)
+{
+
+    // 0028: d9
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0028[0])) return;
+}
+
+static const BlockOp ops_00_0030[] = {
+    { 0xd9, { 0x00, 0x00 }, 1 },
+};
+
+static void block_00_0030(const AOTContext *ctx)
+{
+
+    // 0030: d9
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0030[0])) return;
+}
+
+static const BlockOp ops_00_0038[] = {
+    { 0xd9, { 0x00, 0x00 }, 1 },
+};
+
+static void block_00_0038(const AOTContext *ctx)
+{
+
+    // 0038: d9
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0038[0])) return;
+}
+
+static const BlockOp ops_00_0040[] = {
+    { 0xd9, { 0x00, 0x00 }, 1 },
+};
+
+static void block_00_0040(const AOTContext *ctx)
+{
+
+    // 0040: d9
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0040[0])) return;
+}
+
+static const BlockOp ops_00_0048[] = {
+    { 0xd9, { 0x00, 0x00 }, 1 },
+};
+
+static void block_00_0048(const AOTContext *ctx)
+{
+
+    // 0048: d9
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0048[0])) return;
+}
+
+static const BlockOp ops_00_0050[] = {
+    { 0x0c, { 0x00, 0x00 }, 1 },
+    { 0xd9, { 0x00, 0x00 }, 1 },
+};
+
+static void block_00_0050(const AOTContext *ctx)
+{
+
+    // 0050: 0c
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0050[0])) return;
+
+    // 0051: d9
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0050[1])) return;
+}
+
+static const BlockOp ops_00_0058[] = {
+    { 0xd9, { 0x00, 0x00 }, 1 },
+};
+
+static void block_00_0058(const AOTContext *ctx)
+{
+
+    // 0058: d9
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0058[0])) return;
+}
+
+static const BlockOp ops_00_0060[] = {
+    { 0xd9, { 0x00, 0x00 }, 1 },
+};
+
+static void block_00_0060(const AOTContext *ctx)
+{
+
+    // 0060: d9
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0060[0])) return;
+}
+
+static const BlockOp ops_00_0100[] = {
+    { 0x00, { 0x00, 0x00 }, 1 },
+    { 0xc3, { 0x50, 0x01 }, 3 },
+};
+
+static void block_00_0100(const AOTContext *ctx)
+{
+    std::uint16_t *r16 = ctx->r16;
+
+    // 0100: 00
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    *ctx->cycles += 1;
+    r16[(int)REG16::PC] += 1;
+
+    // 0101: c3 50 01
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    r16[(int)REG16::PC] = 0x0150;
+    *ctx->cycles += 4;
+}
+
+static const BlockOp ops_00_0150[] = {
+    { 0x31, { 0xfe, 0xff }, 3 },
+    { 0x3e, { 0x05, 0x00 }, 2 },
+    { 0xe0, { 0x07, 0x00 }, 2 },
+    { 0x3e, { 0x04, 0x00 }, 2 },
+    { 0xe0, { 0xff, 0x00 }, 2 },
+    { 0xfb, { 0x00, 0x00 }, 1 },
+    { 0x21, { 0x00, 0xc0 }, 3 },
+    { 0x01, { 0x00, 0x00 }, 3 },
+    { 0x04, { 0x00, 0x00 }, 1 },
+    { 0x78, { 0x00, 0x00 }, 1 },
+    { 0xc6, { 0x03, 0x00 }, 2 },
+    { 0xa9, { 0x00, 0x00 }, 1 },
+    { 0x4f, { 0x00, 0x00 }, 1 },
+    { 0x22, { 0x00, 0x00 }, 1 },
+    { 0x03, { 0x00, 0x00 }, 1 },
+    { 0x7c, { 0x00, 0x00 }, 1 },
+    { 0xe6, { 0xcf, 0x00 }, 2 },
+    { 0x67, { 0x00, 0x00 }, 1 },
+    { 0xcd, { 0x00, 0x02 }, 3 },
+};
+
+static void block_00_0150(const AOTContext *ctx)
+{
+    std::uint8_t *r8 = ctx->r8;
+    std::uint16_t *r16 = ctx->r16;
+
+    // 0150: 31 fe ff
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    r16[(int)REG16::SP] = 0xfffe;
+    *ctx->cycles += 3;
+    r16[(int)REG16::PC] += 3;
+
+    // 0153: 3e 05
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    r8[(int)REG8::A] = 0x05;
+    *ctx->cycles += 2;
+    r16[(int)REG16::PC] += 2;
+
+    // 0155: e0 07
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0150[2])) return;
+
+    // 0157: 3e 04
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    r8[(int)REG8::A] = 0x04;
+    *ctx->cycles += 2;
+    r16[(int)REG16::PC] += 2;
+
+    // 0159: e0 ff
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0150[4])) return;
+
+    // 015b: fb
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    *ctx->ime = true;
+    *ctx->cycles += 1;
+    r16[(int)REG16::PC] += 1;
+
+    // 015c: 21 00 c0
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    r16[(int)REG16::HL] = 0xc000;
+    *ctx->cycles += 3;
+    r16[(int)REG16::PC] += 3;
+
+    // 015f: 01 00 00
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    r16[(int)REG16::BC] = 0x0000;
+    *ctx->cycles += 3;
+    r16[(int)REG16::PC] += 3;
+
+    // 0162: 04
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0150[8])) return;
+
+    // 0163: 78
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    r8[(int)REG8::A] = r8[(int)REG8::B];
+    *ctx->cycles += 1;
+    r16[(int)REG16::PC] += 1;
+
+    // 0164: c6 03
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    aot_add(ctx, 0x03, false, true);
+    *ctx->cycles += 2;
+    r16[(int)REG16::PC] += 2;
+
+    // 0166: a9
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    aot_logic(ctx, (std::uint8_t)(r8[(int)REG8::A] ^ r8[(int)REG8::C]), false);
+    *ctx->cycles += 1;
+    r16[(int)REG16::PC] += 1;
+
+    // 0167: 4f
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    r8[(int)REG8::C] = r8[(int)REG8::A];
+    *ctx->cycles += 1;
+    r16[(int)REG16::PC] += 1;
+
+    // 0168: 22
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0150[13])) return;
+
+    // 0169: 03
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    ++r16[(int)REG16::BC];
+    *ctx->cycles += 2;
+    r16[(int)REG16::PC] += 1;
+
+    // 016a: 7c
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    r8[(int)REG8::A] = r8[(int)REG8::H];
+    *ctx->cycles += 1;
+    r16[(int)REG16::PC] += 1;
+
+    // 016b: e6 cf
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    aot_logic(ctx, (std::uint8_t)(r8[(int)REG8::A] & 0xcf), true);
+    *ctx->cycles += 2;
+    r16[(int)REG16::PC] += 2;
+
+    // 016d: 67
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    r8[(int)REG8::H] = r8[(int)REG8::A];
+    *ctx->cycles += 1;
+    r16[(int)REG16::PC] += 1;
+
+    // 016e: cd 00 02
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0150[18])) return;
+}
+
+static const BlockOp ops_00_0162[] = {
+    { 0x04, { 0x00, 0x00 }, 1 },
+    { 0x78, { 0x00, 0x00 }, 1 },
+    { 0xc6, { 0x03, 0x00 }, 2 },
+    { 0xa9, { 0x00, 0x00 }, 1 },
+    { 0x4f, { 0x00, 0x00 }, 1 },
+    { 0x22, { 0x00, 0x00 }, 1 },
+    { 0x03, { 0x00, 0x00 }, 1 },
+    { 0x7c, { 0x00, 0x00 }, 1 },
+    { 0xe6, { 0xcf, 0x00 }, 2 },
+    { 0x67, { 0x00, 0x00 }, 1 },
+    { 0xcd, { 0x00, 0x02 }, 3 },
+};
+
+static void block_00_0162(const AOTContext *ctx)
+{
+    std::uint8_t *r8 = ctx->r8;
+    std::uint16_t *r16 = ctx->r16;
+
+    // 0162: 04
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0162[0])) return;
+
+    // 0163: 78
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    r8[(int)REG8::A] = r8[(int)REG8::B];
+    *ctx->cycles += 1;
+    r16[(int)REG16::PC] += 1;
+
+    // 0164: c6 03
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    aot_add(ctx, 0x03, false, true);
+    *ctx->cycles += 2;
+    r16[(int)REG16::PC] += 2;
+
+    // 0166: a9
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    aot_logic(ctx, (std::uint8_t)(r8[(int)REG8::A] ^ r8[(int)REG8::C]), false);
+    *ctx->cycles += 1;
+    r16[(int)REG16::PC] += 1;
+
+    // 0167: 4f
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    r8[(int)REG8::C] = r8[(int)REG8::A];
+    *ctx->cycles += 1;
+    r16[(int)REG16::PC] += 1;
+
+    // 0168: 22
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0162[5])) return;
+
+    // 0169: 03
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    ++r16[(int)REG16::BC];
+    *ctx->cycles += 2;
+    r16[(int)REG16::PC] += 1;
+
+    // 016a: 7c
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    r8[(int)REG8::A] = r8[(int)REG8::H];
+    *ctx->cycles += 1;
+    r16[(int)REG16::PC] += 1;
+
+    // 016b: e6 cf
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    aot_logic(ctx, (std::uint8_t)(r8[(int)REG8::A] & 0xcf), true);
+    *ctx->cycles += 2;
+    r16[(int)REG16::PC] += 2;
+
+    // 016d: 67
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    r8[(int)REG8::H] = r8[(int)REG8::A];
+    *ctx->cycles += 1;
+    r16[(int)REG16::PC] += 1;
+
+    // 016e: cd 00 02
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0162[10])) return;
+}
+
+static const BlockOp ops_00_0171[] = {
+    { 0x18, { 0xef, 0x00 }, 2 },
+};
+
+static void block_00_0171(const AOTContext *ctx)
+{
+    std::uint16_t *r16 = ctx->r16;
+
+    // 0171: 18 ef
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    *ctx->cycles += 3;
+    r16[(int)REG16::PC] += -15;
+}
+
+static const BlockOp ops_00_0200[] = {
+    { 0x3d, { 0x00, 0x00 }, 1 },
+    { 0x90, { 0x00, 0x00 }, 1 },
+    { 0x5f, { 0x00, 0x00 }, 1 },
+    { 0xc9, { 0x00, 0x00 }, 1 },
+};
+
+static void block_00_0200(const AOTContext *ctx)
+{
+    std::uint8_t *r8 = ctx->r8;
+    std::uint16_t *r16 = ctx->r16;
+
+    // 0200: 3d
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0200[0])) return;
+
+    // 0201: 90
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    aot_add(ctx, r8[(int)REG8::B], true, true);
+    *ctx->cycles += 1;
+    r16[(int)REG16::PC] += 1;
+
+    // 0202: 5f
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    r8[(int)REG8::E] = r8[(int)REG8::A];
+    *ctx->cycles += 1;
+    r16[(int)REG16::PC] += 1;
+
+    // 0203: c9
+    if (*ctx->ime && ctx->interrupt_due(ctx->cpu)) return;
+    if (ctx->run_op(ctx->cpu, &ops_00_0200[3])) return;
+}
+
+static const AOTBlock blocks[] = {
+    { 0, 0x0000, 1, ops_00_0000, &block_00_0000 },
+    { 0, 0x0008, 1, ops_00_0008, &block_00_0008 },
+    { 0, 0x0010, 1, ops_00_0010, &block_00_0010 },
+    { 0, 0x0018, 1, ops_00_0018, &block_00_0018 },
+    { 0, 0x0020, 1, ops_00_0020, &block_00_0020 },
+    { 0, 0x0028, 1, ops_00_0028, &block_00_0028 },
+    { 0, 0x0030, 1, ops_00_0030, &block_00_0030 },
+    { 0, 0x0038, 1, ops_00_0038, &block_00_0038 },
+    { 0, 0x0040, 1, ops_00_0040, &block_00_0040 },
+    { 0, 0x0048, 1, ops_00_0048, &block_00_0048 },
+    { 0, 0x0050, 2, ops_00_0050, &block_00_0050 },
+    { 0, 0x0058, 1, ops_00_0058, &block_00_0058 },
+    { 0, 0x0060, 1, ops_00_0060, &block_00_0060 },
+    { 0, 0x0100, 2, ops_00_0100, &block_00_0100 },
+    { 0, 0x0150, 19, ops_00_0150, &block_00_0150 },
+    { 0, 0x0162, 11, ops_00_0162, &block_00_0162 },
+    { 0, 0x0171, 1, ops_00_0171, &block_00_0171 },
+    { 0, 0x0200, 4, ops_00_0200, &block_00_0200 },
+};
+
+static const AOTPlugin plugin = { AOT_VERSION, 0x0000, 18, blocks };
+
+AOT_EXPORT const AOTPlugin* gb_aot_plugin()
+{
+    return &plugin;
+}
@@ -0,0 +1,93 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// PC breakpoints, with and without conditions, in every CPU mode.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "test.hpp"
+#include "test_roms.hpp"
+
+static const CPUMode all_modes[] = { CPUMode::microcode, CPUMode::instruction, CPUMode::block, CPUMode::jit };
+
+// A loop counting in B and C. The block modes only check breakpoints between
+// blocks, so the tests break at the start of the loop.
+static std::unique_ptr<System> load_loop_rom(CPUMode mode)
+{
+    std::string rom = make_rom(0x00);
+    put_code(rom, 0x150, {
+        0x04,               // inc b
+        0x0c,               // inc c
+        0x18, 0xfc,         // jr -4
+    });
+
+    std::unique_ptr<System> sys = load_rom(rom);
+    sys->cpu_mode = mode;
+    return sys;
+}
+
+TEST(breakpoint_stops_run)
+{
+    for (CPUMode mode : all_modes)
+    {
+        std::unique_ptr<System> sys = load_loop_rom(mode);
+        sys->breakpoints.add(0x150);
+
+        CHECK(sys->run_until(100000) == StopReason::breakpoint);
+        CHECK(sys->cpu.getPC() == 0x150);
+        std::uint8_t B = sys->cpu.getState().B;
+
+        // Running again leaves the breakpoint before looking for it.
+        CHECK(sys->run_until(100000) == StopReason::breakpoint);
+        CHECK(sys->cpu.getPC() == 0x150);
+        CHECK(sys->cpu.getState().B == (std::uint8_t)(B + 1));
+
+        sys->breakpoints.remove(0x150);
+        CHECK(sys->run_until(100000) == StopReason::done);
+        CHECK(sys->cycles() >= 100000);
+    }
+}
+
+TEST(conditional_breakpoint)
+{
+    for (CPUMode mode : all_modes)
+    {
+        std::unique_ptr<System> sys = load_loop_rom(mode);
+        sys->breakpoints.add(0x150, Condition("B == 5"));
+
+        CHECK(sys->run_until(100000) == StopReason::breakpoint);
+        CHECK(sys->cpu.getPC() == 0x150);
+        CHECK(sys->cpu.getState().B == 5);
+
+        // Once round B doesn't come back to 5 before the end.
+        CHECK(sys->run_until(sys->cycles() + 1000) == StopReason::done);
+    }
+}
+
+TEST(false_condition_doesnt_stop)
+{
+    for (CPUMode mode : all_modes)
+    {
+        std::unique_ptr<System> sys = load_loop_rom(mode);
+        sys->breakpoints.add(0x150, Condition("B == C + 1"));
+
+        CHECK(sys->run_until(100000) == StopReason::done);
+        CHECK(sys->cycles() >= 100000);
+    }
+}
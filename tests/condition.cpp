@@ -0,0 +1,188 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Parsing and evaluating breakpoint and watchpoint conditions.
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "test.hpp"
+#include "test_roms.hpp"
+
+static CPUState test_state()
+{
+    CPUState s;
+    s.A = 0x12;
+    s.F = 0xb0;
+    s.B = 0x34;
+    s.C = 0x56;
+    s.D = 0x78;
+    s.E = 0x9a;
+    s.H = 0xbc;
+    s.L = 0xde;
+    s.PC = 0x1234;
+    s.SP = 0xfffe;
+    s.ime = true;
+    return s;
+}
+
+static bool holds(const std::string &text, std::uint64_t cycles = 0)
+{
+    static std::unique_ptr<System> sys;
+    if (!sys)
+    {
+        sys = load_rom(make_rom(0x00));
+        sys->mmu.write_mem(0xc000, 0xf3);
+        sys->mmu.write_mem(0xc0f3, 0x07);
+    }
+    return Condition(text).evaluate(test_state(), sys->mmu, cycles);
+}
+
+// The error message, or empty if text parses.
+static std::string error(const std::string &text)
+{
+    try
+    {
+        Condition cond(text);
+    }
+    catch (std::runtime_error &e)
+    {
+        return e.what();
+    }
+    return "";
+}
+
+static bool nested_too_deeply(const std::string &text)
+{
+    return error(text).find("too deeply nested") != std::string::npos;
+}
+
+TEST(condition_precedence)
+{
+    CHECK(holds("1 + 2 == 3"));
+    CHECK(holds("1 == 1 && 2 == 2"));
+    // && binds tighter than ||.
+    CHECK(holds("0 && 0 || 1"));
+    CHECK(holds("1 || 1 && 0"));
+    // + - & | ^ share a level and go left to right.
+    CHECK(holds("1 - 1 - 1 == -1"));
+    CHECK(holds("2 + 3 & 1 == 1"));
+    CHECK(holds("1 | 2 ^ 3 == 0"));
+    // So do the comparisons.
+    CHECK(holds("2 < 3 == 1"));
+    CHECK(!holds("3 > 2 > 1"));
+    // Unary operators bind tightest.
+    CHECK(holds("-1 + 2 == 1"));
+    CHECK(holds("!0 == 1"));
+    CHECK(holds("!5 == 0"));
+    CHECK(holds("~0 == -1"));
+    CHECK(holds("!(1 - 1)"));
+    CHECK(holds("-(2 + 3) == -5"));
+}
+
+TEST(condition_short_circuit)
+{
+    // The result is always 0 or 1, whichever side decided it.
+    CHECK(holds("(2 && 3) == 1"));
+    CHECK(holds("(0 || 5) == 1"));
+    CHECK(holds("(5 || 0) == 1"));
+    CHECK(holds("(0 && 5) == 0"));
+    CHECK(holds("(1 || 0) + 1 == 2"));
+
+    // Skipping the right side leaves the stack as it would have been.
+    CHECK(holds("1 || 0 || 0"));
+    CHECK(!holds("0 && 1 && 1"));
+    CHECK(holds("(0 && 1) || 1"));
+    CHECK(holds("0 && 1 || 1"));
+    CHECK(!holds("1 && 0 || 0 && 1"));
+    CHECK(holds("((1 || 0) && (0 || 1)) + ((0 && 1) || 1) == 2"));
+}
+
+TEST(condition_loads)
+{
+    CHECK(holds("[0xc0f3] == 7"));
+    CHECK(holds("[$c0f3] > 5"));
+    CHECK(holds("[0xc0f0 + 3] == 7"));
+    CHECK(holds("[0xc000 + [0xc000]] == 7"));
+    CHECK(holds("[[0xc000] + 0xc000] == 7"));
+    CHECK(holds("[0xc001] == 0"));
+}
+
+TEST(condition_operands)
+{
+    CHECK(holds("A == 0x12 && F == 0xb0 && B == 0x34 && C == 0x56"));
+    CHECK(holds("D == 0x78 && E == 0x9a && H == 0xbc && L == 0xde"));
+    CHECK(holds("AF == 0x12b0 && BC == 0x3456 && DE == 0x789a && HL == 0xbcde"));
+    CHECK(holds("SP == 0xfffe && PC == 0x1234 && IME == 1"));
+    CHECK(holds("a == 0x12 && hl == 48350"));
+    CHECK(holds("[HL - 0xbcde + 0xc0f3] == 7"));
+
+    CHECK(holds("CYCLES == 1234", 1234));
+    CHECK(!holds("CYCLES == 1234", 1235));
+    CHECK(holds("CYCLES > 0x100000000", 0x100000001ull));
+    CHECK(!holds("CYCLES > 0x100000000", 0x100000000ull));
+    CHECK(holds("Cycles - 0x123456789 == 1", 0x12345678aull));
+}
+
+TEST(condition_errors)
+{
+    CHECK(error("A == 1") == "");
+    CHECK(error("A == 1 )") == "Bad condition at column 8: unexpected character");
+    CHECK(error("A ==") == "Bad condition at column 5: unexpected end");
+    CHECK(error("(A == 1") == "Bad condition at column 8: expected )");
+    CHECK(error("[0xc000 == 1") == "Bad condition at column 13: expected ]");
+    CHECK(error("Q == 1") == "Bad condition at column 2: unknown name");
+    CHECK(error("0x") == "Bad condition at column 3: expected digits");
+    CHECK(error("12a") == "Bad condition at column 3: bad digit");
+    CHECK(error("0x10000000000000000") != "");
+    CHECK(error("!= 1") == "Bad condition at column 1: expected a value");
+    CHECK(error("A = 1") == "Bad condition at column 3: unexpected character");
+    CHECK(error("") == "Bad condition at column 1: unexpected end");
+
+    // An empty condition always holds.
+    CHECK(Condition().empty());
+}
+
+TEST(condition_max_stack)
+{
+    // Nesting to the right needs another slot for each value.
+    std::string text = "1";
+    for (int i = 1; i < 16; ++i) text = "1 + (" + text + ")";
+    CHECK(error(text) == "");
+    CHECK(nested_too_deeply("1 + (" + text + ")"));
+
+    // To the left it doesn't.
+    text = "1";
+    for (int i = 1; i < 100; ++i) text += " + 1";
+    CHECK(holds(text + " == 100"));
+}
+
+TEST(condition_max_nesting)
+{
+    std::string text = "1";
+    for (int i = 0; i < 40; ++i) text = "(" + text + ")";
+    CHECK(holds(text));
+    CHECK(holds(std::string(40, '!') + "1"));
+
+    // Deep enough to overflow the native stack without the limit.
+    CHECK(nested_too_deeply(std::string(100000, '(') + "1" + std::string(100000, ')')));
+    CHECK(nested_too_deeply(std::string(100000, '[') + "1" + std::string(100000, ']')));
+    CHECK(nested_too_deeply(std::string(100000, '!') + "1"));
+    CHECK(nested_too_deeply(std::string(100000, '-') + "1"));
+}
@@ -0,0 +1,546 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Differential tests between the CPU modes. Each runs ROMs in two
+// modes side by side and checks they pass through the same states.
+
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "aot.hpp"
+#include "recompiler.hpp"
+#include "test.hpp"
+#include "test_roms.hpp"
+
+static const std::uint32_t random_roms = 32;
+
+// Everything visible between instructions that the modes have to agree on.
+static std::string describe(System &sys)
+{
+    CPUState s = sys.cpu.getState();
+    std::ostringstream out;
+    out << std::hex << std::setfill('0') <<
+        "AF=" << std::setw(2) << (int)s.A << std::setw(2) << (int)s.F <<
+        " BC=" << std::setw(2) << (int)s.B << std::setw(2) << (int)s.C <<
+        " DE=" << std::setw(2) << (int)s.D << std::setw(2) << (int)s.E <<
+        " HL=" << std::setw(2) << (int)s.H << std::setw(2) << (int)s.L <<
+        " PC=" << std::setw(4) << s.PC << " SP=" << std::setw(4) << s.SP <<
+        " ime=" << s.ime << " halt=" << sys.cpu.isHalting() <<
+        " DIV=" << std::setw(2) << (int)sys.timer.getDIV() <<
+        " TIMA=" << std::setw(2) << (int)sys.timer.getTIMA() <<
+        " IF=" << std::setw(2) << (int)sys.ic.getIF() <<
+        std::dec << " cycle=" << sys.cycles();
+    return out.str();
+}
+
+// Steps sys, returning the error if it threw.
+static std::string try_step(System &sys)
+{
+    try
+    {
+        sys.step();
+    }
+    catch (std::exception &e)
+    {
+        return e.what();
+    }
+    return std::string();
+}
+
+// Steps sys, and ref until it has caught up, then checks the states match.
+// Block modes run a block a step, so ref may take several steps to get to
+// the same place. Returns false once they differ or either has failed.
+static bool step_both(System &ref, System &sys, const std::string &where)
+{
+    // Code can run into memory that isn't there yet, both modes have to
+    // fail on the same instruction. The state is left mid instruction then,
+    // so there's nothing more to compare.
+    std::string error = try_step(sys);
+    std::string ref_error;
+    for (;;)
+    {
+        std::uint64_t before = ref.cycles();
+        ref_error = try_step(ref);
+        if (!ref_error.empty() || ref.cycles() == before) break;
+        // Where sys failed ref hasn't run the instruction yet.
+        if (error.empty() ? ref.cycles() >= sys.cycles() : ref.cycles() > sys.cycles()) break;
+    }
+
+    if (!ref_error.empty() || !error.empty())
+    {
+        if (ref_error != error)
+        {
+            std::cout << "  " << where << ": \"" << ref_error << "\" against \"" << error << "\"" << std::endl;
+        }
+        CHECK(ref_error == error);
+        return false;
+    }
+
+    std::string ref_state = describe(ref);
+    std::string state = describe(sys);
+    if (ref_state != state)
+    {
+        std::cout << "  " << where << ":\n" <<
+            "    " << ref_state << "\n" <<
+            "    " << state << std::endl;
+        CHECK(ref_state == state);
+        return false;
+    }
+    return true;
+}
+
+// Runs rom in both modes side by side for steps steps of sys, which runs the
+// blocks of plugin if there is one.
+static void compare_rom(const std::string &rom, CPUMode ref_mode, CPUMode mode, std::uint32_t steps, const std::string &name,
+    const AOTPlugin *plugin = nullptr)
+{
+    std::unique_ptr<System> ref = load_rom(rom);
+    std::unique_ptr<System> sys = load_rom(rom);
+    ref->cpu_mode = ref_mode;
+    sys->cpu_mode = mode;
+    if (plugin) sys->blocks.set_aot(plugin);
+
+    for (std::uint32_t i = 0; i < steps; ++i)
+    {
+        std::ostringstream where;
+        where << name << ", step " << i;
+        if (!step_both(*ref, *sys, where.str())) break;
+    }
+}
+
+static void compare_modes(CPUMode ref_mode, CPUMode mode, std::uint32_t steps)
+{
+    for (std::uint32_t seed = 1; seed <= random_roms; ++seed)
+    {
+        std::ostringstream name;
+        name << "ROM " << seed;
+        compare_rom(make_random_rom(seed), ref_mode, mode, steps, name.str());
+    }
+}
+
+TEST(instruction_mode_matches_microcode)
+{
+    compare_modes(CPUMode::microcode, CPUMode::instruction, 50000);
+}
+
+TEST(block_mode_matches_microcode)
+{
+    compare_modes(CPUMode::microcode, CPUMode::block, 10000);
+}
+
+// A routine copied into WRAM that returns a count in its own immediate, which
+// the caller bumps each time. Cached blocks have to see the writes.
+static std::string make_ram_code_rom()
+{
+    std::string rom = make_rom(0x00);
+    put_code(rom, 0x150, {
+        0x31, 0xfe, 0xff,   // ld sp,0xfffe
+        0x21, 0x00, 0xc0,   // ld hl,0xc000
+        0x36, 0x3e,         // ld (hl),0x3e     ld a,n
+        0x23,               // inc hl
+        0x36, 0x00,         // ld (hl),0x00
+        0x23,               // inc hl
+        0x36, 0xc9,         // ld (hl),0xc9     ret
+        0xcd, 0x00, 0xc0,   // call 0xc000
+        0x3c,               // inc a
+        0xea, 0x01, 0xc0,   // ld (0xc001),a
+        0x18, 0xf7,         // jr -9
+    });
+    return rom;
+}
+
+TEST(block_mode_sees_code_writes)
+{
+    std::string rom = make_ram_code_rom();
+    compare_rom(rom, CPUMode::microcode, CPUMode::block, 2000, "RAM code");
+    compare_rom(rom, CPUMode::microcode, CPUMode::jit, 2000, "RAM code, jit");
+
+    // Stale code would keep loading 0 and store 1 every time.
+    std::unique_ptr<System> sys = load_rom(rom);
+    sys->cpu_mode = CPUMode::block;
+    CHECK(sys->run_for(1000) == StopReason::done);
+    CHECK(sys->mmu.peek_mem(0xc001) > 10);
+}
+
+// jit_check runs a copy of the system in the microcode engine alongside and
+// throws if the two disagree.
+// Each of the copy and fill loops run_idiom() runs in bulk, with interrupts
+// off and the timer running, then a copy with them on.
+static std::string make_idiom_rom()
+{
+    std::string rom = make_rom(0x00);
+    for (std::size_t adr = 0; adr < 0x100; adr += 8) rom[adr] = (char)0xd9;
+
+    put_code(rom, 0x150, {
+        0xf3,               // di
+        0x31, 0xfe, 0xff,   // ld sp,0xfffe
+        0x3e, 0x05,         // ld a,0x05
+        0xe0, 0x07,         // ldh (TAC),a
+        0x3e, 0x04,         // ld a,0x04
+        0xe0, 0xff,         // ldh (IE),a
+
+        // fill_b, 0x40 bytes of 0x5a at 0xc000.
+        0x21, 0x00, 0xc0,   // ld hl,0xc000
+        0x3e, 0x5a,         // ld a,0x5a
+        0x06, 0x40,         // ld b,0x40
+        0x22,               // ld (hl+),a
+        0x05,               // dec b
+        0x20, 0xfc,         // jr nz,-4
+
+        // fill_c, 0x100 bytes of 0xa5 at 0xc100.
+        0x21, 0x00, 0xc1,   // ld hl,0xc100
+        0x3e, 0xa5,         // ld a,0xa5
+        0x0e, 0x00,         // ld c,0x00
+        0x22,               // ld (hl+),a
+        0x0d,               // dec c
+        0x20, 0xfc,         // jr nz,-4
+
+        // copy_b, 0xc000 to 0xc200.
+        0x21, 0x00, 0xc0,   // ld hl,0xc000
+        0x11, 0x00, 0xc2,   // ld de,0xc200
+        0x06, 0x40,         // ld b,0x40
+        0x2a,               // ld a,(hl+)
+        0x12,               // ld (de),a
+        0x13,               // inc de
+        0x05,               // dec b
+        0x20, 0xfa,         // jr nz,-6
+
+        // copy_c, 0xc100 to 0xc300.
+        0x21, 0x00, 0xc1,   // ld hl,0xc100
+        0x11, 0x00, 0xc3,   // ld de,0xc300
+        0x0e, 0x80,         // ld c,0x80
+        0x2a,               // ld a,(hl+)
+        0x12,               // ld (de),a
+        0x13,               // inc de
+        0x0d,               // dec c
+        0x20, 0xfa,         // jr nz,-6
+
+        // copy_bc, 0x1000 bytes onto themselves a byte on, which repeats
+        // the first byte through them all.
+        0x21, 0x00, 0xc0,   // ld hl,0xc000
+        0x11, 0x01, 0xc0,   // ld de,0xc001
+        0x01, 0x00, 0x10,   // ld bc,0x1000
+        0x2a,               // ld a,(hl+)
+        0x12,               // ld (de),a
+        0x13,               // inc de
+        0x0b,               // dec bc
+        0x78,               // ld a,b
+        0xb1,               // or c
+        0x20, 0xf8,         // jr nz,-8
+
+        // copy_bc again with interrupts on.
+        0xfb,               // ei
+        0x21, 0x00, 0xc0,   // ld hl,0xc000
+        0x11, 0x00, 0xd0,   // ld de,0xd000
+        0x01, 0x00, 0x0c,   // ld bc,0x0c00
+        0x2a,               // ld a,(hl+)
+        0x12,               // ld (de),a
+        0x13,               // inc de
+        0x0b,               // dec bc
+        0x78,               // ld a,b
+        0xb1,               // or c
+        0x20, 0xf8,         // jr nz,-8
+
+        0x18, 0xfe,         // jr -2
+    });
+    return rom;
+}
+
+TEST(idioms_match_microcode)
+{
+    std::string rom = make_idiom_rom();
+    compare_rom(rom, CPUMode::microcode, CPUMode::block, 2000, "idiom ROM, block");
+    compare_rom(rom, CPUMode::microcode, CPUMode::jit, 2000, "idiom ROM, jit");
+
+    std::unique_ptr<System> sys = load_rom(rom);
+    sys->cpu_mode = CPUMode::block;
+    CHECK(sys->run_for(200000) == StopReason::done);
+    CHECK(sys->mmu.peek_mem(0xc0ff) == 0x5a);
+    CHECK(sys->mmu.peek_mem(0xc2ff) == 0x5a);
+    CHECK(sys->mmu.peek_mem(0xd123) == 0x5a);
+}
+
+// The bulk copies stop short of the next event even with interrupts off, so
+// runs end on time.
+TEST(idioms_stop_at_run_end)
+{
+    const CPUMode modes[] = { CPUMode::block, CPUMode::jit };
+    for (CPUMode mode : modes)
+    {
+        std::unique_ptr<System> sys = load_rom(make_idiom_rom());
+        sys->cpu_mode = mode;
+        for (int i = 0; i < 200; ++i)
+        {
+            std::uint64_t end = sys->cycles() + 500;
+            CHECK(sys->run_until(end) == StopReason::done);
+            // A block or an interrupt dispatch past it at most.
+            if (sys->cycles() > end + 32) std::cout << "  ran to " << sys->cycles() << " for " << end << std::endl;
+            CHECK(sys->cycles() <= end + 32);
+        }
+    }
+}
+
+// A loop polling the I/O register at reg until it reads 0x90, counting the
+// times it does in D. The timer runs throughout, and with irq its interrupt
+// is on and counted in C. Nothing writes LY, so a poll of it never ends and
+// gets skipped, while DIV and TIMA change with time.
+static std::string make_poll_rom(std::uint8_t reg, bool irq)
+{
+    std::string rom = make_rom(0x00);
+    for (std::size_t adr = 0; adr < 0x100; adr += 8) rom[adr] = (char)0xd9;
+    put_code(rom, 0x50, { 0x0c, 0xd9 });
+
+    put_code(rom, 0x150, {
+        0x31, 0xfe, 0xff,   // ld sp,0xfffe
+        0x3e, 0x05,         // ld a,0x05
+        0xe0, 0x07,         // ldh (TAC),a
+        0x3e, 0x04,         // ld a,0x04
+        0xe0, 0xff,         // ldh (IE),a
+        irq ? (std::uint8_t)0xfb : (std::uint8_t)0xf3,  // ei or di
+        0xf0, reg,          // ldh a,(reg)
+        0xfe, 0x90,         // cp 0x90
+        0x20, 0xfa,         // jr nz,-6
+        0x14,               // inc d
+        0x18, 0xf7,         // jr -9
+    });
+    return rom;
+}
+
+TEST(polls_match_microcode)
+{
+    const std::uint8_t regs[] = { 0x04, 0x05, 0x44 };
+    const CPUMode modes[] = { CPUMode::block, CPUMode::jit };
+    for (std::uint8_t reg : regs)
+    {
+        for (int irq = 0; irq < 2; ++irq)
+        {
+            std::ostringstream name;
+            name << "poll of ff" << std::hex << (int)reg << (irq ? " with" : " without") << " the timer interrupt";
+            std::string rom = make_poll_rom(reg, irq != 0);
+
+            for (CPUMode mode : modes)
+            {
+                compare_rom(rom, CPUMode::microcode, mode, 3000, name.str());
+
+                // Runs ending part way through a skipped stretch stop at the
+                // same place. Microcode stops at the first instruction
+                // boundary from the end, so is run to where the block ended.
+                std::unique_ptr<System> ref = load_rom(rom);
+                std::unique_ptr<System> sys = load_rom(rom);
+                sys->cpu_mode = mode;
+                for (int i = 0; i < 50; ++i)
+                {
+                    CHECK(sys->run_for(7919) == StopReason::done);
+                    CHECK(ref->run_until(sys->cycles()) == StopReason::done);
+                    std::string ref_state = describe(*ref);
+                    std::string state = describe(*sys);
+                    if (ref_state != state)
+                    {
+                        std::cout << "  " << name.str() << ", run " << i << ":\n" <<
+                            "    " << ref_state << "\n" <<
+                            "    " << state << std::endl;
+                        CHECK(ref_state == state);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// MBC1 with RAM. Each bank switches to the next from under itself, so the
+// rest of its code comes from the new bank, then turns the RAM on or off and
+// counts in it.
+static std::string make_bank_rom()
+{
+    std::string rom = make_rom(0x03, 2, 2);
+    put_code(rom, 0x150, {
+        0xc3, 0x00, 0x40,   // jp 0x4000
+    });
+
+    for (std::uint8_t bank = 1; bank < 8; ++bank)
+    {
+        put_code(rom, bank * 0x4000, {
+            0x04,                                   // inc b
+            0x3e, (std::uint8_t)(bank % 7 + 1),     // ld a,next bank
+            0xea, 0x00, 0x20,                       // ld (0x2000),a
+            0x0e, bank,                             // ld c,bank
+            0x3e, (std::uint8_t)(bank & 1 ? 0x0a : 0x00),  // ld a,RAM on or off
+            0xea, 0x00, 0x00,                       // ld (0x0000),a
+            0xfa, 0x00, 0xa0,                       // ld a,(0xa000)
+            0x3c,                                   // inc a
+            0xea, 0x00, 0xa0,                       // ld (0xa000),a
+            0xc3, 0x00, 0x40,                       // jp 0x4000
+        });
+    }
+    return rom;
+}
+
+TEST(bank_switches_match_microcode)
+{
+    std::string rom = make_bank_rom();
+    compare_rom(rom, CPUMode::microcode, CPUMode::block, 3000, "bank switches");
+    compare_rom(rom, CPUMode::microcode, CPUMode::jit, 3000, "bank switches");
+}
+
+TEST(jit_matches_microcode)
+{
+    for (std::uint32_t seed = 1; seed <= random_roms; ++seed)
+    {
+        std::unique_ptr<System> sys = load_rom(make_random_rom(seed));
+        sys->cpu_mode = CPUMode::jit_check;
+
+        try
+        {
+            for (int i = 0; i < 20000; ++i) sys->step();
+        }
+        catch (std::runtime_error &e)
+        {
+            // The random code running into an op code that doesn't exist is
+            // all that's expected. Anything else fails, and exceptions of
+            // other types fail the test on their way out.
+            std::string error = e.what();
+            if (error != "Unimplemented op code") std::cout << "  ROM " << seed << ": " << error << std::endl;
+            CHECK(error == "Unimplemented op code");
+        }
+    }
+}
+
+TEST(jit_check_picked_late)
+{
+    std::unique_ptr<System> sys = load_rom(make_random_rom(1));
+    sys->step();
+    sys->cpu_mode = CPUMode::jit_check;
+
+    bool threw = false;
+    try
+    {
+        sys->step();
+    }
+    catch (std::logic_error &)
+    {
+        threw = true;
+    }
+    CHECK(threw);
+}
+
+// tests/aot_fixture.cpp is gb-recompile's output for make_aot_rom(), built
+// into gb-tests. aot_fixture_is_current prints what it should be if the ROM
+// or the recompiler's choice of blocks has changed.
+AOT_EXPORT const AOTPlugin* gb_aot_plugin();
+
+// A loop of ops the recompiler writes natively and ones it calls back for,
+// with the timer interrupt going off through it.
+static std::string make_aot_rom()
+{
+    std::string rom = make_rom(0x00);
+
+    // reti at every RST and interrupt vector, the timer's counts in C.
+    for (std::size_t adr = 0; adr < 0x100; adr += 8) rom[adr] = (char)0xd9;
+    put_code(rom, 0x50, { 0x0c, 0xd9 });
+
+    put_code(rom, 0x150, {
+        0x31, 0xfe, 0xff,   // ld sp,0xfffe
+        0x3e, 0x05,         // ld a,0x05
+        0xe0, 0x07,         // ldh (TAC),a
+        0x3e, 0x04,         // ld a,0x04
+        0xe0, 0xff,         // ldh (IE),a
+        0xfb,               // ei
+        0x21, 0x00, 0xc0,   // ld hl,0xc000
+        0x01, 0x00, 0x00,   // ld bc,0x0000
+        0x04,               // inc b
+        0x78,               // ld a,b
+        0xc6, 0x03,         // add a,0x03
+        0xa9,               // xor c
+        0x4f,               // ld c,a
+        0x22,               // ld (hl+),a
+        0x03,               // inc bc
+        0x7c,               // ld a,h
+        0xe6, 0xcf,         // and 0xcf
+        0x67,               // ld h,a
+        0xcd, 0x00, 0x02,   // call 0x200
+        0x18, 0xef,         // jr -17
+    });
+    put_code(rom, 0x200, {
+        0x3d,               // dec a
+        0x90,               // sub b
+        0x5f,               // ld e,a
+        0xc9,               // ret
+    });
+    return rom;
+}
+
+TEST(aot_fixture_is_current)
+{
+    std::unique_ptr<System> sys = load_rom(make_aot_rom());
+    std::map<std::uint32_t, FoundBlock> found = find_blocks(sys->cart);
+    const AOTPlugin *plugin = gb_aot_plugin();
+
+    bool same = plugin->num_blocks == found.size();
+    for (std::size_t i = 0; same && i < plugin->num_blocks; ++i)
+    {
+        const AOTBlock &block = plugin->blocks[i];
+        auto it = found.find((std::uint32_t)block.bank << 16 | block.adr);
+        same = it != found.end() && block.num_ops == it->second.ops.size();
+        for (std::size_t op = 0; same && op < block.num_ops; ++op)
+        {
+            const BlockOp &a = block.ops[op];
+            const BlockOp &b = it->second.ops[op];
+            same = a.op_code == b.op_code && a.length == b.length && a.imm[0] == b.imm[0] && a.imm[1] == b.imm[1];
+        }
+    }
+
+    if (!same)
+    {
+        std::cout << "  tests/aot_fixture.cpp should be:\n";
+        write_plugin(std::cout, sys->cart, found);
+    }
+    CHECK(same);
+}
+
+TEST(aot_matches_microcode)
+{
+    std::string rom = make_aot_rom();
+    compare_rom(rom, CPUMode::microcode, CPUMode::block, 5000, "AOT ROM, block", gb_aot_plugin());
+    compare_rom(rom, CPUMode::microcode, CPUMode::jit, 5000, "AOT ROM, jit", gb_aot_plugin());
+
+    std::unique_ptr<System> sys = load_rom(rom);
+    sys->blocks.set_aot(gb_aot_plugin());
+    CHECK(sys->blocks.lookup(0x150)->aot != nullptr);
+    CHECK(sys->blocks.lookup(0x200)->aot != nullptr);
+}
+
+// A block whose code differs from what the plugin was built from is left to
+// the interpreter, even though the checksum and the number of ops match.
+TEST(aot_checks_block_code)
+{
+    std::string rom = make_aot_rom();
+    // add a,0x04
+    rom[0x165] = 0x04;
+    compare_rom(rom, CPUMode::microcode, CPUMode::block, 5000, "changed AOT ROM", gb_aot_plugin());
+
+    std::unique_ptr<System> sys = load_rom(rom);
+    sys->blocks.set_aot(gb_aot_plugin());
+    CHECK(sys->blocks.lookup(0x150)->aot == nullptr);
+    CHECK(sys->blocks.lookup(0x200)->aot != nullptr);
+}
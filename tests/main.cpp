@@ -0,0 +1,93 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Runs the tests, or only those whose names contain one of the arguments.
+//
+// Usage: gb-tests [name...]
+
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "test.hpp"
+
+struct TestCase
+{
+    const char *name;
+    void (*fn)();
+};
+
+// Filled in by the registrars of each file, so it has to be set up on first
+// use rather than depend on the order files are initialised in.
+static std::vector<TestCase>& test_cases()
+{
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+static int failures;
+
+TestRegistrar::TestRegistrar(const char *name, void (*fn)())
+{
+    test_cases().push_back({ name, fn });
+}
+
+void check_failed(const char *file, int line, const char *expr)
+{
+    std::cout << "  " << file << "(" << line << "): CHECK(" << expr << ") failed" << std::endl;
+    ++failures;
+}
+
+static bool selected(const TestCase &test, int argc, char **argv)
+{
+    if (argc < 2) return true;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(test.name).find(argv[i]) != std::string::npos) return true;
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    int run = 0;
+    int failed = 0;
+
+    for (const TestCase &test : test_cases())
+    {
+        if (!selected(test, argc, argv)) continue;
+
+        std::cout << test.name << std::endl;
+        int before = failures;
+        try
+        {
+            test.fn();
+        }
+        catch (std::exception &e)
+        {
+            std::cout << "  threw: " << e.what() << std::endl;
+            ++failures;
+        }
+
+        ++run;
+        if (failures != before) ++failed;
+    }
+
+    std::cout << run - failed << " of " << run << " tests passed" << std::endl;
+    return failed ? 1 : 0;
+}
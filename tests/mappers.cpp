@@ -0,0 +1,303 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Bank switching, cart RAM and MBC3's clock, through the MMU.
+
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "test.hpp"
+#include "test_roms.hpp"
+
+// Each bank past the first starts with its number, low byte first.
+static std::unique_ptr<System> load_banked_rom(std::uint8_t cart_type, std::uint8_t rom_size, std::uint8_t ram_size)
+{
+    std::string rom = make_rom(cart_type, rom_size, ram_size);
+    for (std::size_t bank = 1; bank < rom.size() / 0x4000; ++bank)
+    {
+        rom[bank * 0x4000] = (char)bank;
+        rom[bank * 0x4000 + 1] = (char)(bank >> 8);
+    }
+    return load_rom(rom);
+}
+
+static unsigned rom_bank(System &sys)
+{
+    return sys.mmu.read_mem(0x4000) | sys.mmu.read_mem(0x4001) << 8;
+}
+
+TEST(mbc1)
+{
+    // 512 KiB ROM, 32 KiB RAM.
+    std::unique_ptr<System> sys = load_banked_rom(0x03, 4, 3);
+    MMU &mmu = sys->mmu;
+
+    CHECK(rom_bank(*sys) == 1);
+    mmu.write_mem(0x2000, 5);
+    CHECK(rom_bank(*sys) == 5);
+    mmu.write_mem(0x2000, 0);
+    CHECK(rom_bank(*sys) == 1);
+    mmu.write_mem(0x2000, 0x21);
+    CHECK(rom_bank(*sys) == 1);
+    mmu.write_mem(0x2000, 31);
+    CHECK(rom_bank(*sys) == 31);
+
+    // RAM is off until enabled.
+    CHECK(mmu.read_mem(0xa000) == 0xff);
+    mmu.write_mem(0xa000, 0x12);
+    CHECK(mmu.read_mem(0xa000) == 0xff);
+    mmu.write_mem(0x0000, 0x0a);
+    mmu.write_mem(0xa000, 0x12);
+    CHECK(mmu.read_mem(0xa000) == 0x12);
+
+    // Mode 1 banks the RAM with the 2 bit register.
+    mmu.write_mem(0x6000, 1);
+    mmu.write_mem(0x4000, 2);
+    CHECK(mmu.read_mem(0xa000) == 0x00);
+    mmu.write_mem(0xa000, 0x34);
+    mmu.write_mem(0x4000, 0);
+    CHECK(mmu.read_mem(0xa000) == 0x12);
+    mmu.write_mem(0x4000, 2);
+    CHECK(mmu.read_mem(0xa000) == 0x34);
+
+    mmu.write_mem(0x0000, 0x00);
+    CHECK(mmu.read_mem(0xa000) == 0xff);
+}
+
+TEST(mbc1_high_bank_bits)
+{
+    // 2 MiB ROM, no RAM.
+    std::unique_ptr<System> sys = load_banked_rom(0x01, 6, 0);
+    MMU &mmu = sys->mmu;
+
+    mmu.write_mem(0x2000, 3);
+    mmu.write_mem(0x4000, 2);
+    CHECK(rom_bank(*sys) == 0x43);
+    mmu.write_mem(0x2000, 0);
+    CHECK(rom_bank(*sys) == 0x41);
+
+    mmu.write_mem(0x0000, 0x0a);
+    CHECK(mmu.read_mem(0xa000) == 0xff);
+}
+
+TEST(mbc2)
+{
+    // 256 KiB ROM and the built in 512 half bytes.
+    std::unique_ptr<System> sys = load_banked_rom(0x06, 3, 0);
+    MMU &mmu = sys->mmu;
+
+    CHECK(rom_bank(*sys) == 1);
+    mmu.write_mem(0x2100, 7);
+    CHECK(rom_bank(*sys) == 7);
+    mmu.write_mem(0x2100, 0);
+    CHECK(rom_bank(*sys) == 1);
+    // With address bit 8 clear it's the RAM enable.
+    mmu.write_mem(0x2000, 9);
+    CHECK(rom_bank(*sys) == 1);
+    mmu.write_mem(0x0100, 0x1f);
+    CHECK(rom_bank(*sys) == 15);
+
+    CHECK(mmu.read_mem(0xa000) == 0xff);
+    mmu.write_mem(0x0000, 0x0a);
+    mmu.write_mem(0xa005, 0xab);
+    CHECK(mmu.read_mem(0xa005) == 0xfb);
+    CHECK(mmu.read_mem(0xa205) == 0xfb);
+    CHECK(mmu.read_mem(0xbe05) == 0xfb);
+    mmu.write_mem(0x0000, 0x00);
+    CHECK(mmu.read_mem(0xa005) == 0xff);
+}
+
+TEST(mbc3)
+{
+    // 2 MiB ROM, 32 KiB RAM and the clock.
+    std::unique_ptr<System> sys = load_banked_rom(0x10, 6, 3);
+    MMU &mmu = sys->mmu;
+
+    mmu.write_mem(0x2000, 0x45);
+    CHECK(rom_bank(*sys) == 0x45);
+    mmu.write_mem(0x2000, 0x00);
+    CHECK(rom_bank(*sys) == 1);
+    mmu.write_mem(0x2000, 0x80);
+    CHECK(rom_bank(*sys) == 1);
+
+    mmu.write_mem(0x0000, 0x0a);
+    for (std::uint8_t bank = 0; bank < 4; ++bank)
+    {
+        mmu.write_mem(0x4000, bank);
+        mmu.write_mem(0xb000, (std::uint8_t)(0x10 + bank));
+    }
+    for (std::uint8_t bank = 0; bank < 4; ++bank)
+    {
+        mmu.write_mem(0x4000, bank);
+        CHECK(mmu.read_mem(0xb000) == 0x10 + bank);
+    }
+
+    // Clock registers read as last latched, and only keep their used bits.
+    mmu.write_mem(0x4000, 0x08);
+    mmu.write_mem(0xa000, 0x7b);
+    CHECK(mmu.read_mem(0xa000) == 0x00);
+    mmu.write_mem(0x6000, 0);
+    mmu.write_mem(0x6000, 1);
+    CHECK(mmu.read_mem(0xa000) == 0x3b);
+    mmu.write_mem(0x4000, 0x0c);
+    mmu.write_mem(0xa000, 0xff);
+    mmu.write_mem(0x6000, 0);
+    mmu.write_mem(0x6000, 1);
+    CHECK(mmu.read_mem(0xbfff) == 0xc1);
+
+    mmu.write_mem(0x4000, 0x01);
+    CHECK(mmu.read_mem(0xb000) == 0x11);
+    mmu.write_mem(0x0000, 0x00);
+    CHECK(mmu.read_mem(0xb000) == 0xff);
+}
+
+static void write_rtc(MMU &mmu, std::uint8_t reg, std::uint8_t val)
+{
+    mmu.write_mem(0x4000, reg);
+    mmu.write_mem(0xa000, val);
+}
+
+static std::uint8_t read_latched(MMU &mmu, std::uint8_t reg)
+{
+    mmu.write_mem(0x4000, reg);
+    return mmu.read_mem(0xa000);
+}
+
+static void latch(MMU &mmu)
+{
+    mmu.write_mem(0x6000, 0);
+    mmu.write_mem(0x6000, 1);
+}
+
+TEST(mbc3_clock)
+{
+    const std::uint64_t second = 1 << 20;
+    std::unique_ptr<System> sys = load_banked_rom(0x10, 0, 0);
+    MMU &mmu = sys->mmu;
+    mmu.write_mem(0x0000, 0x0a);
+
+    // A second short of day 512, which wraps to day 0 and sets the carry.
+    write_rtc(mmu, 0x08, 58);
+    write_rtc(mmu, 0x09, 59);
+    write_rtc(mmu, 0x0a, 23);
+    write_rtc(mmu, 0x0b, 0xff);
+    write_rtc(mmu, 0x0c, 0x01);
+
+    sys->scheduler.advance(second);
+    latch(mmu);
+    CHECK(read_latched(mmu, 0x08) == 59);
+    CHECK(read_latched(mmu, 0x0c) == 0x01);
+
+    // The latched values hold still until latched again.
+    sys->scheduler.advance(second);
+    CHECK(read_latched(mmu, 0x08) == 59);
+    latch(mmu);
+    CHECK(read_latched(mmu, 0x08) == 0);
+    CHECK(read_latched(mmu, 0x09) == 0);
+    CHECK(read_latched(mmu, 0x0a) == 0);
+    CHECK(read_latched(mmu, 0x0b) == 0);
+    CHECK(read_latched(mmu, 0x0c) == 0x80);
+
+    // Nothing counts while halted.
+    write_rtc(mmu, 0x0c, 0x40);
+    sys->scheduler.advance(10 * second);
+    latch(mmu);
+    CHECK(read_latched(mmu, 0x08) == 0);
+
+    write_rtc(mmu, 0x0c, 0x00);
+    sys->scheduler.advance(3 * 60 * second + 5 * second);
+    latch(mmu);
+    CHECK(read_latched(mmu, 0x08) == 5);
+    CHECK(read_latched(mmu, 0x09) == 3);
+}
+
+TEST(mbc5)
+{
+    // 8 MiB ROM, 128 KiB RAM.
+    std::unique_ptr<System> sys = load_banked_rom(0x1b, 8, 4);
+    MMU &mmu = sys->mmu;
+
+    CHECK(rom_bank(*sys) == 1);
+    // Bank 0 can be mapped at 0x4000.
+    mmu.write_mem(0x2000, 0x00);
+    CHECK(rom_bank(*sys) == 0);
+    mmu.write_mem(0x2000, 0xff);
+    CHECK(rom_bank(*sys) == 0xff);
+    mmu.write_mem(0x3000, 0x01);
+    CHECK(rom_bank(*sys) == 0x1ff);
+    mmu.write_mem(0x2000, 0x23);
+    CHECK(rom_bank(*sys) == 0x123);
+    mmu.write_mem(0x3000, 0x00);
+    CHECK(rom_bank(*sys) == 0x23);
+
+    mmu.write_mem(0x0000, 0x0a);
+    for (std::uint8_t bank = 0; bank < 16; ++bank)
+    {
+        mmu.write_mem(0x4000, bank);
+        mmu.write_mem(0xa123, (std::uint8_t)(0x40 + bank));
+    }
+    for (std::uint8_t bank = 0; bank < 16; ++bank)
+    {
+        mmu.write_mem(0x4000, bank);
+        CHECK(mmu.read_mem(0xa123) == 0x40 + bank);
+    }
+}
+
+TEST(mbc5_bank_wraps)
+{
+    // 1 MiB ROM, no RAM.
+    std::unique_ptr<System> sys = load_banked_rom(0x19, 5, 0);
+    MMU &mmu = sys->mmu;
+
+    mmu.write_mem(0x2000, 0x45);
+    CHECK(rom_bank(*sys) == 0x05);
+    mmu.write_mem(0x0000, 0x0a);
+    CHECK(mmu.read_mem(0xa000) == 0xff);
+}
+
+TEST(cart_copy_keeps_banks)
+{
+    std::unique_ptr<System> sys = load_banked_rom(0x03, 4, 3);
+    sys->mmu.write_mem(0x2000, 31);
+
+    System copy;
+    copy.cart = sys->cart;
+    copy.mmu.map_cart();
+    CHECK(rom_bank(copy) == 31);
+}
+
+TEST(unsupported_mapper)
+{
+    std::unique_ptr<System> sys = load_banked_rom(0x01, 2, 0);
+
+    // MBC7.
+    std::istringstream in(make_rom(0x22));
+    bool threw = false;
+    try
+    {
+        sys->cart.loadCart(in);
+    }
+    catch (std::runtime_error &)
+    {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(sys->cart.getHeader().cart_type.controller == CartController::MBC1);
+}
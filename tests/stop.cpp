@@ -0,0 +1,87 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// STOP mode. The CPU and the timer stop, but runs still end on time.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "test.hpp"
+#include "test_roms.hpp"
+
+static std::unique_ptr<System> load_stop_rom(CPUMode mode)
+{
+    std::string rom = make_rom(0x00);
+    put_code(rom, 0x150, {
+        0x3e, 0x05,         // ld a,0x05
+        0xe0, 0x07,         // ldh (TAC),a
+        0x10, 0x00,         // stop
+        0x3c,               // inc a
+        0x18, 0xfd,         // jr -3
+    });
+
+    std::unique_ptr<System> sys = load_rom(rom);
+    sys->cpu_mode = mode;
+    return sys;
+}
+
+static void check_stop(CPUMode mode)
+{
+    std::unique_ptr<System> sys = load_stop_rom(mode);
+
+    CHECK(sys->run_for(1000) == StopReason::done);
+    CHECK(sys->cpu.isStopped());
+    std::uint8_t TIMA = sys->timer.getTIMA();
+    CHECK(sys->timer.getDIV() == 0);
+
+    // Well past the point DIV and TIMA would have wrapped if they ran.
+    std::uint64_t end = sys->cycles() + 100000;
+    CHECK(sys->run_until(end) == StopReason::done);
+    CHECK(sys->cycles() == end);
+    CHECK(sys->cpu.isStopped());
+    CHECK(sys->timer.getDIV() == 0);
+    CHECK(sys->timer.getTIMA() == TIMA);
+
+    // A joypad interrupt request ends it, and everything carries on.
+    sys->ic.signal_joypad_irq();
+    CHECK(sys->run_for(1000) == StopReason::done);
+    CHECK(!sys->cpu.isStopped());
+    CHECK(sys->timer.getDIV() != 0);
+    CHECK(sys->timer.getTIMA() != TIMA);
+    CHECK(sys->cpu.getState().A != 0x05);
+}
+
+TEST(stop_microcode)
+{
+    check_stop(CPUMode::microcode);
+}
+
+TEST(stop_instruction)
+{
+    check_stop(CPUMode::instruction);
+}
+
+TEST(stop_block)
+{
+    check_stop(CPUMode::block);
+}
+
+TEST(stop_jit)
+{
+    check_stop(CPUMode::jit);
+}
@@ -0,0 +1,41 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEST_HPP
+#define TEST_HPP
+
+// A small test harness. TEST(name) { ... } defines a test for gb-tests to
+// run, and CHECK(cond) records a failure without stopping the test. Tests
+// also fail by throwing.
+
+#define TEST(name) \
+    static void test_##name(); \
+    static const TestRegistrar registrar_##name(#name, &test_##name); \
+    static void test_##name()
+
+#define CHECK(cond) \
+    do { if (!(cond)) check_failed(__FILE__, __LINE__, #cond); } while (0)
+
+class TestRegistrar
+{
+public:
+    TestRegistrar(const char *name, void (*fn)());
+};
+
+void check_failed(const char *file, int line, const char *expr);
+
+#endif
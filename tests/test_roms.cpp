@@ -0,0 +1,104 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <random>
+#include <sstream>
+
+#include "test_roms.hpp"
+
+std::string make_rom(std::uint8_t cart_type, std::uint8_t rom_size, std::uint8_t ram_size)
+{
+    std::string rom((std::size_t)0x8000 << rom_size, '\0');
+
+    // nop; jp 0x150
+    put_code(rom, 0x100, { 0x00, 0xc3, 0x50, 0x01 });
+    rom.replace(0x134, 4, "TEST");
+    rom[0x147] = (char)cart_type;
+    rom[0x148] = (char)rom_size;
+    rom[0x149] = (char)ram_size;
+    return rom;
+}
+
+static bool random_allowed(std::uint8_t op_code)
+{
+    switch (op_code)
+    {
+    // ld sp,nn; ld sp,hl; add sp,n; inc sp; dec sp
+    case 0x31: case 0xf9: case 0xe8: case 0x33: case 0x3b:
+    // stop
+    case 0x10:
+    // Not implemented by the hardware.
+    case 0xd3: case 0xdb: case 0xdd: case 0xe3: case 0xe4: case 0xeb:
+    case 0xec: case 0xed: case 0xf4: case 0xfc: case 0xfd:
+        return false;
+    default:
+        return true;
+    }
+}
+
+std::string make_random_rom(std::uint32_t seed)
+{
+    std::string rom = make_rom(0x00);
+
+    // How the distributions map the generator's output is up to the
+    // library, so bytes are taken straight from the generator to get the
+    // same ROM everywhere.
+    std::mt19937 rng(seed);
+    for (std::size_t adr = 0x200; adr < rom.size(); ++adr)
+    {
+        std::uint8_t val;
+        do val = (std::uint8_t)rng(); while (!random_allowed(val));
+        rom[adr] = (char)val;
+    }
+
+    // reti at every RST and interrupt vector.
+    for (std::size_t adr = 0; adr < 0x100; adr += 8) rom[adr] = (char)0xd9;
+
+    put_code(rom, 0x150, {
+        0x31, 0xf8, 0xff,   // ld sp,0xfff8
+        0x3e, 0x05,         // ld a,0x05
+        0xe0, 0x07,         // ldh (TAC),a
+        0x3e, 0x04,         // ld a,0x04
+        0xe0, 0xff,         // ldh (IE),a
+        0xfb,               // ei
+        0xc3, 0x00, 0x02,   // jp 0x200
+    });
+    return rom;
+}
+
+void put_code(std::string &rom, std::size_t adr, std::initializer_list<std::uint8_t> code)
+{
+    for (std::uint8_t val : code) rom.at(adr++) = (char)val;
+}
+
+std::unique_ptr<System> load_rom(std::string rom)
+{
+    std::uint8_t checksum = 0;
+    for (std::size_t adr = 0x134; adr < 0x14d; ++adr) checksum = (std::uint8_t)(checksum - (std::uint8_t)rom[adr] - 1);
+    rom[0x14d] = (char)checksum;
+
+    std::unique_ptr<System> sys(new System());
+    std::istringstream in(rom);
+    sys->cart.loadCart(in);
+    sys->reset();
+
+    for (std::uint32_t adr = 0x8000; adr < 0xa000; ++adr) sys->mmu.write_mem((std::uint16_t)adr, 0);
+    for (std::uint32_t adr = 0xc000; adr < 0xe000; ++adr) sys->mmu.write_mem((std::uint16_t)adr, 0);
+    for (std::uint32_t adr = 0xfe00; adr < 0xfea0; ++adr) sys->mmu.write_mem((std::uint16_t)adr, 0);
+    for (std::uint32_t adr = 0xff80; adr < 0xffff; ++adr) sys->mmu.write_mem((std::uint16_t)adr, 0);
+    return sys;
+}
@@ -0,0 +1,47 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEST_ROMS_HPP
+#define TEST_ROMS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+
+#include "system.hpp"
+
+// ROM images for the tests, built in memory so the tests need no files.
+
+// A ROM of 32 KiB << rom_size of zeros, with a header for the given cart type
+// and RAM size. load_rom() fills in the header checksum.
+std::string make_rom(std::uint8_t cart_type, std::uint8_t rom_size = 0, std::uint8_t ram_size = 0);
+
+// A 32 KiB ROM of random instructions from seed. It turns on the timer and its
+// interrupt, whose vector returns straight away, then jumps into the random
+// code. Op codes that move SP somewhere random, STOP and the ones that don't
+// exist are left out.
+std::string make_random_rom(std::uint32_t seed);
+
+void put_code(std::string &rom, std::size_t adr, std::initializer_list<std::uint8_t> code);
+
+// A System with rom loaded and reset, and its RAM and OAM cleared so that runs can be
+// repeated.
+std::unique_ptr<System> load_rom(std::string rom);
+
+#endif
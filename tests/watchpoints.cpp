@@ -0,0 +1,149 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Memory watchpoints in every CPU mode, including the bulk copies and fills
+// the block modes do in one go. The block modes stop at the end of the block
+// that hit the watchpoint, the others right after the instruction.
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "test.hpp"
+#include "test_roms.hpp"
+
+static const CPUMode all_modes[] = { CPUMode::microcode, CPUMode::instruction, CPUMode::block, CPUMode::jit };
+
+// Fills 0xc000-0xc03f with 0x5a, copies it to 0xc200, then spins.
+static std::unique_ptr<System> load_fill_copy_rom(CPUMode mode)
+{
+    std::string rom = make_rom(0x00);
+    put_code(rom, 0x150, {
+        0x21, 0x00, 0xc0,   // ld hl,0xc000
+        0x3e, 0x5a,         // ld a,0x5a
+        0x06, 0x40,         // ld b,0x40
+        0x22,               // ld (hl+),a
+        0x05,               // dec b
+        0x20, 0xfc,         // jr nz,-4
+        0x21, 0x00, 0xc0,   // ld hl,0xc000
+        0x11, 0x00, 0xc2,   // ld de,0xc200
+        0x06, 0x40,         // ld b,0x40
+        0x2a,               // ld a,(hl+)
+        0x12,               // ld (de),a
+        0x13,               // inc de
+        0x05,               // dec b
+        0x20, 0xfa,         // jr nz,-6
+        0x18, 0xfe,         // jr -2
+    });
+
+    std::unique_ptr<System> sys = load_rom(rom);
+    sys->cpu_mode = mode;
+    return sys;
+}
+
+static bool runs_blocks(CPUMode mode)
+{
+    return mode == CPUMode::block || mode == CPUMode::jit;
+}
+
+static Watchpoint watch(std::uint16_t first, std::uint16_t last, bool on_read, bool on_write, std::int16_t value = -1, const Condition &condition = Condition())
+{
+    return Watchpoint{ first, last, on_read, on_write, value, condition };
+}
+
+TEST(write_watchpoint_in_fill)
+{
+    for (CPUMode mode : all_modes)
+    {
+        std::unique_ptr<System> sys = load_fill_copy_rom(mode);
+        sys->mmu.add_watchpoint(watch(0xc030, 0xc030, false, true));
+
+        CHECK(sys->run_until(100000) == StopReason::watchpoint);
+        CHECK(sys->mmu.getWatchHits().size() == 1);
+        const WatchpointHit &hit = sys->mmu.getWatchHits()[0];
+        CHECK(hit.adr == 0xc030);
+        CHECK(hit.write);
+        CHECK(hit.old_val == 0x00);
+        CHECK(hit.new_val == 0x5a);
+        CHECK(hit.index == 0);
+
+        // Stopped in the pass that wrote it, not at the end of the fill.
+        CHECK(sys->mmu.peek_mem(0xc030) == 0x5a);
+        CHECK(sys->mmu.peek_mem(0xc031) == 0x00);
+        CHECK(sys->cpu.getState().B == (runs_blocks(mode) ? 0x0f : 0x10));
+
+        sys->mmu.clear_watch_hits();
+        CHECK(sys->run_until(100000) == StopReason::done);
+        CHECK(sys->mmu.peek_mem(0xc23f) == 0x5a);
+    }
+}
+
+TEST(read_watchpoint_in_copy)
+{
+    for (CPUMode mode : all_modes)
+    {
+        std::unique_ptr<System> sys = load_fill_copy_rom(mode);
+        sys->mmu.add_watchpoint(watch(0xc010, 0xc010, true, false));
+
+        CHECK(sys->run_until(100000) == StopReason::watchpoint);
+        CHECK(sys->mmu.getWatchHits().size() == 1);
+        const WatchpointHit &hit = sys->mmu.getWatchHits()[0];
+        CHECK(hit.adr == 0xc010);
+        CHECK(!hit.write);
+        CHECK(hit.new_val == 0x5a);
+        CHECK(sys->mmu.peek_mem(0xc210) == (runs_blocks(mode) ? 0x5a : 0x00));
+        CHECK(sys->mmu.peek_mem(0xc211) == 0x00);
+    }
+}
+
+TEST(watchpoint_on_copy_destination)
+{
+    for (CPUMode mode : all_modes)
+    {
+        std::unique_ptr<System> sys = load_fill_copy_rom(mode);
+        sys->mmu.add_watchpoint(watch(0xc220, 0xc22f, false, true));
+
+        CHECK(sys->run_until(100000) == StopReason::watchpoint);
+        CHECK(sys->mmu.getWatchHits().size() == 1);
+        CHECK(sys->mmu.getWatchHits()[0].adr == 0xc220);
+        CHECK(sys->mmu.peek_mem(0xc221) == 0x00);
+    }
+}
+
+TEST(watchpoint_value_and_condition)
+{
+    for (CPUMode mode : all_modes)
+    {
+        // Nothing writes 0x77.
+        std::unique_ptr<System> sys = load_fill_copy_rom(mode);
+        sys->mmu.add_watchpoint(watch(0xc000, 0xc03f, false, true, 0x77));
+        CHECK(sys->run_until(100000) == StopReason::done);
+        CHECK(sys->mmu.getWatchHits().empty());
+
+        // Every write in the fill hits, the condition picks out one.
+        sys = load_fill_copy_rom(mode);
+        sys->mmu.add_watchpoint(watch(0xc000, 0xc03f, false, true, 0x5a, Condition("[0xc030] != 0")));
+        CHECK(sys->run_until(100000) == StopReason::watchpoint);
+        CHECK(sys->mmu.peek_mem(0xc030) == 0x5a);
+        CHECK(sys->mmu.peek_mem(0xc031) == 0x00);
+
+        sys = load_fill_copy_rom(mode);
+        sys->mmu.add_watchpoint(watch(0xc000, 0xc03f, false, true, -1, Condition("B == 0x80")));
+        CHECK(sys->run_until(100000) == StopReason::done);
+        CHECK(sys->mmu.peek_mem(0xc03f) == 0x5a);
+    }
+}
@@ -0,0 +1,421 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Benchmarks for the CPU core, for comparing data layouts with the same work
+// run over each. Every benchmark is run a few times and the best time is
+// reported, to keep out noise from the rest of the machine.
+//
+// Usage: gb-benchmark [passes]
+//
+// passes is how many times the table benchmarks go over their instructions.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "instructions.hpp"
+#include "system.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+static const int runs = 5;
+
+// Results of the benchmarks end up here, so they can't be optimised away.
+static volatile std::uint32_t sink;
+
+// Seconds the fastest of runs calls of fn took.
+template<typename Fn>
+static double best_of(Fn fn)
+{
+    double best = 0;
+    for (int i = 0; i < runs; i++)
+    {
+        Clock::time_point start = Clock::now();
+        fn();
+        double secs = std::chrono::duration<double>(Clock::now() - start).count();
+        if (i == 0 || secs < best) best = secs;
+    }
+    return best;
+}
+
+// The microcode table laid out as one of the micro-op types, the same way
+// Instructions lays out its own table.
+template<typename Op>
+struct OpTable
+{
+    std::vector<Op> table;
+    std::array<std::size_t, 256> ops;
+    std::array<std::size_t, 256> cb_ops;
+};
+
+template<typename Op>
+static OpTable<Op> make_table(const std::vector<Instructions::Instruction> &main_ops,
+                              const std::vector<Instructions::Instruction> &cb)
+{
+    OpTable<Op> out;
+    for (std::size_t i = 0; i < main_ops.size(); i++)
+    {
+        out.ops[i] = out.table.size();
+        for (const CPU_Control &ctrl : main_ops[i]) out.table.push_back(Op(ctrl));
+    }
+    for (std::size_t i = 0; i < cb.size(); i++)
+    {
+        out.cb_ops[i] = out.table.size();
+        for (const CPU_Control &ctrl : cb[i]) out.table.push_back(Op(ctrl));
+    }
+    for (const CPU_Control &ctrl : Instructions::make_interrupt_op()) out.table.push_back(Op(ctrl));
+    return out;
+}
+
+// Every field CPU::step() used to look at, folded together so none of the
+// loads can be left out.
+static std::uint32_t fields(const CPU_Control &c)
+{
+    return c.read | c.write << 1 | c.decode << 2 | c.decode_cb << 3 | c.ld << 4 |
+        c.with_carry << 5 | c.ignore_zero << 6 | c.mask << 8 |
+        ((int)c.adr ^ (int)c.mem_reg ^ (int)c.src ^ (int)c.dst ^ (int)c.alu_r16 ^ (int)c.alu_r8) << 16 |
+        ((int)c.alu_op ^ (int)c.cond_op ^ (int)c.sys_op) << 24;
+}
+
+static std::uint32_t fields(const PackedControl &c)
+{
+    return c.read() | c.write() << 1 | c.decode() << 2 | c.decode_cb() << 3 | c.ld() << 4 |
+        c.with_carry() << 5 | c.ignore_zero() << 6 | c.mask() << 8 |
+        ((int)c.adr() ^ (int)c.mem_reg() ^ (int)c.src() ^ (int)c.dst() ^ (int)c.alu_r16() ^ (int)c.alu_r8()) << 16 |
+        ((int)c.alu_op() ^ (int)c.cond_op() ^ (int)c.sys_op()) << 24;
+}
+
+static bool ends_instruction(const CPU_Control &c) { return c.decode || c.decode_cb; }
+static bool ends_instruction(const PackedControl &c) { return c.decode() || c.decode_cb(); }
+
+// Table indices of the first micro-op of a random stream of instructions,
+// with CB prefixed ones followed by their second half.
+template<typename Op>
+static std::vector<std::size_t> make_stream(const OpTable<Op> &t,
+                                            const std::vector<Instructions::Instruction> &main_ops,
+                                            std::size_t length)
+{
+    std::mt19937 rng(2017);
+    std::vector<std::size_t> out;
+    while (out.size() < length)
+    {
+        std::uint8_t op_code = (std::uint8_t)rng();
+        if (main_ops[op_code].empty()) continue;
+        out.push_back(t.ops[op_code]);
+        if (op_code == 0xcb) out.push_back(t.cb_ops[(std::uint8_t)rng()]);
+    }
+    return out;
+}
+
+// Reads every micro-op of the stream in turn, as the microcode engine would
+// running those instructions. Between instructions it also reads a few bytes
+// spread over other, standing in for the rest of the emulator's working set
+// competing with the table for the cache. Its size has to be a power of two.
+// Returns the micro-ops read.
+template<typename Op>
+static std::size_t walk(const OpTable<Op> &t, const std::vector<std::size_t> &stream,
+                        const std::vector<std::uint8_t> &other, std::uint32_t &sum)
+{
+    std::size_t count = 0;
+    std::size_t pos = 0;
+    for (std::size_t start : stream)
+    {
+        const Op *op = &t.table[start];
+        for (;; op++)
+        {
+            sum += fields(*op);
+            count++;
+            if (ends_instruction(*op)) break;
+        }
+        for (int i = 0; i < 4 && !other.empty(); i++)
+        {
+            pos = (pos * 5 + 0x1fc1) & (other.size() - 1);
+            sum += other[pos];
+        }
+    }
+    return count;
+}
+
+template<typename Op>
+static void bench_layout(const char *name, const OpTable<Op> &t, const std::vector<std::size_t> &stream,
+                         const std::vector<std::uint8_t> &other, int passes)
+{
+    std::uint32_t sum = 0;
+    std::size_t count = 0;
+    double secs = best_of([&]
+    {
+        count = 0;
+        for (int i = 0; i < passes; i++) count += walk(t, stream, other, sum);
+    });
+
+    std::cout << "  " << std::left << std::setw(14) << name << std::right <<
+        std::setw(3) << sizeof(Op) << " bytes per op, " <<
+        std::setw(6) << t.table.size() * sizeof(Op) << " bytes in all: " <<
+        std::fixed << std::setprecision(2) << secs * 1e9 / (double)count << " ns per op\n";
+    sink = sum;
+}
+
+// CPU_Control, which the CPU used to step through, against the PackedControl
+// it steps through now.
+static void bench_layouts(int passes)
+{
+    const std::vector<Instructions::Instruction> main_ops = Instructions::make_ops();
+    const std::vector<Instructions::Instruction> cb = Instructions::make_cb_ops();
+
+    OpTable<CPU_Control> plain = make_table<CPU_Control>(main_ops, cb);
+    OpTable<PackedControl> packed = make_table<PackedControl>(main_ops, cb);
+    // Both tables are laid out the same, so the stream suits either.
+    std::vector<std::size_t> stream = make_stream(plain, main_ops, 1 << 14);
+
+    std::cout << "Micro-op layouts, " << plain.table.size() << " micro-ops, " <<
+        passes << " passes over " << stream.size() << " instructions:\n";
+    for (std::size_t other_size : { 0, 32 * 1024 })
+    {
+        std::vector<std::uint8_t> other(other_size, 1);
+        std::cout << " with " << other_size / 1024 << " KiB of other data:\n";
+        bench_layout("CPU_Control", plain, stream, other, passes);
+        bench_layout("PackedControl", packed, stream, other, passes);
+    }
+}
+
+// Registers as the CPU used to keep them, in separate members picked out
+// with a switch.
+class SwitchRegisters
+{
+public:
+    SwitchRegisters() : A(0), F(0), B(0), C(0), D(0), E(0), H(0), L(0), SP(0), PC(0), T(0) {}
+
+    std::uint8_t get8(REG8 reg) const
+    {
+        switch (reg)
+        {
+        case REG8::A: return A;
+        case REG8::F: return F;
+        case REG8::B: return B;
+        case REG8::C: return C;
+        case REG8::D: return D;
+        case REG8::E: return E;
+        case REG8::H: return H;
+        case REG8::L: return L;
+        case REG8::PCH: return (std::uint8_t)(PC >> 8);
+        case REG8::PCL: return (std::uint8_t)(PC);
+        case REG8::SPH: return (std::uint8_t)(SP >> 8);
+        case REG8::SPL: return (std::uint8_t)(SP);
+        case REG8::TH: return (std::uint8_t)(T >> 8);
+        case REG8::TL: return (std::uint8_t)(T);
+        default: return 0;
+        }
+    }
+
+    void set8(REG8 reg, std::uint8_t val)
+    {
+        switch (reg)
+        {
+        case REG8::A: A = val; break;
+        case REG8::F: F = val & CPU::all_flags_mask; break;
+        case REG8::B: B = val; break;
+        case REG8::C: C = val; break;
+        case REG8::D: D = val; break;
+        case REG8::E: E = val; break;
+        case REG8::H: H = val; break;
+        case REG8::L: L = val; break;
+        case REG8::PCH: PC = (std::uint16_t)((PC & 0x00FF) | (val << 8)); break;
+        case REG8::PCL: PC = (std::uint16_t)((PC & 0xFF00) | val); break;
+        case REG8::SPH: SP = (std::uint16_t)((SP & 0x00FF) | (val << 8)); break;
+        case REG8::SPL: SP = (std::uint16_t)((SP & 0xFF00) | val); break;
+        case REG8::TH: T = (std::uint16_t)((T & 0x00FF) | (val << 8)); break;
+        case REG8::TL: T = (std::uint16_t)((T & 0xFF00) | val); break;
+        default: break;
+        }
+    }
+
+    std::uint32_t sum() const { return A + F + B + C + D + E + H + L + SP + PC + T; }
+
+private:
+    std::uint8_t A, F, B, C, D, E, H, L;
+    std::uint16_t SP, PC, T;
+};
+
+// Registers as the CPU keeps them now, a word array with REG8 indexing its
+// bytes and a mask table for the bits of F that can't be set.
+class IndexedRegisters
+{
+public:
+    IndexedRegisters() { regs.fill(0); }
+
+    std::uint8_t get8(REG8 reg) const { return reinterpret_cast<const std::uint8_t*>(regs.data())[(int)reg]; }
+    void set8(REG8 reg, std::uint8_t val)
+    {
+        reinterpret_cast<std::uint8_t*>(regs.data())[(int)reg] = val & write_mask[(int)reg];
+    }
+
+    std::uint32_t sum() const
+    {
+        std::uint32_t out = 0;
+        for (std::uint16_t reg : regs) out += reg;
+        return out;
+    }
+
+private:
+    std::array<std::uint16_t, 8> regs;
+    static const std::uint8_t write_mask[16];
+};
+
+const std::uint8_t IndexedRegisters::write_mask[16] = {
+    0x00, 0x00, CPU::all_flags_mask, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// Does the 8-bit register traffic of every micro-op of the stream: the
+// memory access, the load and the ALU op. Returns the micro-ops run.
+template<typename Regs>
+static std::size_t run_registers(Regs &regs, const OpTable<PackedControl> &t, const std::vector<std::size_t> &stream)
+{
+    std::size_t count = 0;
+    for (std::size_t start : stream)
+    {
+        const PackedControl *op = &t.table[start];
+        for (;; op++)
+        {
+            if (op->mem_reg() != REG8::none) regs.set8(op->mem_reg(), (std::uint8_t)(regs.get8(op->mem_reg()) + 1));
+            if (op->ld()) regs.set8(op->dst(), regs.get8(op->src()));
+            if (op->alu_r8() != REG8::none) regs.set8(op->alu_r8(), (std::uint8_t)(regs.get8(op->alu_r8()) ^ 0x5a));
+            count++;
+            if (ends_instruction(*op)) break;
+        }
+    }
+    return count;
+}
+
+template<typename Regs>
+static void bench_register_file(const char *name, const OpTable<PackedControl> &t,
+                                const std::vector<std::size_t> &stream, int passes)
+{
+    Regs regs;
+    std::size_t count = 0;
+    double secs = best_of([&]
+    {
+        count = 0;
+        for (int i = 0; i < passes; i++) count += run_registers(regs, t, stream);
+    });
+    sink = regs.sum();
+
+    std::cout << "  " << std::left << std::setw(17) << name << std::right <<
+        std::fixed << std::setprecision(2) << secs * 1e9 / (double)count << " ns per op\n";
+}
+
+// Register access through the switches getr8() and setr8() used to have,
+// against the register file indexed by REG8 the CPU has now.
+static void bench_register_files(int passes)
+{
+    const std::vector<Instructions::Instruction> main_ops = Instructions::make_ops();
+    OpTable<PackedControl> t = make_table<PackedControl>(main_ops, Instructions::make_cb_ops());
+    std::vector<std::size_t> stream = make_stream(t, main_ops, 1 << 14);
+
+    std::cout << "Register files, " << passes << " passes over " << stream.size() << " instructions:\n";
+    bench_register_file<SwitchRegisters>("switch", t, stream, passes);
+    bench_register_file<IndexedRegisters>("indexed", t, stream, passes);
+}
+
+// A ROM that spends all its time in a loop of plain ALU and memory ops, with
+// no interrupts.
+static std::string make_loop_rom()
+{
+    std::string rom(0x8000, '\0');
+    static const std::uint8_t code[] = {
+        0x00, 0xc3, 0x50, 0x01,     // 0x100: nop; jp 0x150
+    };
+    static const std::uint8_t loop[] = {
+        0x31, 0xf8, 0xff,           // 0x150: ld sp,0xfff8
+        0x21, 0x00, 0xc0,           //        ld hl,0xc000
+        0x06, 0x00,                 // 0x156: ld b,0
+        0x2a,                       // 0x158: ld a,(hl+)
+        0x80,                       //        add a,b
+        0xa9,                       //        xor c
+        0x4f,                       //        ld c,a
+        0x26, 0xc0,                 //        ld h,0xc0
+        0xcb, 0x11,                 //        rl c
+        0x05,                       //        dec b
+        0x20, 0xf5,                 //        jr nz,0x158
+        0xc3, 0x56, 0x01,           //        jp 0x156
+    };
+    std::copy(std::begin(code), std::end(code), rom.begin() + 0x100);
+    std::copy(std::begin(loop), std::end(loop), rom.begin() + 0x150);
+    rom.replace(0x134, 5, "BENCH");
+
+    std::uint8_t checksum = 0;
+    for (std::size_t adr = 0x134; adr < 0x14d; ++adr) checksum = (std::uint8_t)(checksum - (std::uint8_t)rom[adr] - 1);
+    rom[0x14d] = (char)checksum;
+    return rom;
+}
+
+// How fast the loop ROM runs in each CPU mode, in emulated machine cycles
+// per second. The hardware runs at about 1.05 MHz.
+static void bench_cpu_modes()
+{
+    static const std::uint64_t cycles = 1 << 24;
+    static const struct { CPUMode mode; const char *name; } modes[] = {
+        { CPUMode::microcode, "microcode" },
+        { CPUMode::instruction, "instruction" },
+        { CPUMode::block, "block" },
+        { CPUMode::jit, "jit" },
+    };
+
+    std::string rom = make_loop_rom();
+    std::cout << "CPU modes, " << cycles << " machine cycles of a CPU bound loop:\n";
+    for (const auto &mode : modes)
+    {
+        std::unique_ptr<System> sys(new System());
+        std::istringstream in(rom);
+        sys->cart.loadCart(in);
+        sys->reset();
+        sys->cpu_mode = mode.mode;
+
+        double secs = best_of([&] { sys->run_for(cycles); });
+        std::cout << "  " << std::left << std::setw(17) << mode.name << std::right <<
+            std::fixed << std::setprecision(1) << (double)cycles / secs / 1e6 << " emulated MHz\n";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        int passes = 200;
+        if (argc > 1) passes = std::stoi(argv[1]);
+        if (passes <= 0) throw std::runtime_error("Usage: gb-benchmark [passes]");
+
+        bench_layouts(passes);
+        bench_register_files(passes);
+        bench_cpu_modes();
+    }
+    catch (std::exception &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
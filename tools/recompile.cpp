@@ -0,0 +1,68 @@
+/*
+Copyright (C) 2017 James Bootsma <jrbootsma@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Writes the blocks of a ROM out as the C++ source of an AOT plugin, see
+// recompiler.hpp.
+//
+// Usage: gb-recompile <rom> [output dir]
+
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include "aot_library.hpp"
+#include "cart.hpp"
+#include "recompiler.hpp"
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        if (argc < 2) throw std::runtime_error("Usage: gb-recompile <rom> [output dir]");
+
+        std::ifstream rom_file(argv[1], std::ios::in | std::ios::binary);
+        if (!rom_file) throw std::runtime_error("Could not open supplied rom.");
+
+        Cart cart;
+        cart.reset();
+        cart.loadCart(rom_file);
+        rom_file.close();
+
+        std::uint16_t checksum = cart.getHeader().global_checksum;
+        std::map<std::uint32_t, FoundBlock> blocks = find_blocks(cart);
+
+        std::string path = AOTLibrary::fileName(checksum);
+        path = path.substr(0, path.find_last_of('.')) + ".cpp";
+        if (argc > 2) path = std::string(argv[2]) + "/" + path;
+
+        std::ofstream out(path);
+        if (!out) throw std::runtime_error("Could not open " + path + " for writing.");
+
+        write_plugin(out, cart, blocks);
+
+        std::cout << "Wrote " << blocks.size() << " blocks to " << path << std::endl;
+    }
+    catch (std::exception &e)
+    {
+        std::cout << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}